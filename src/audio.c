@@ -18,24 +18,13 @@ EnvelopeGen envelope_gen_init(float attack, float decay,
         .released = false};
 }
 
-EnvelopeGen envelope_gen_for_instrument(Instrument *instrument) {
-    const float attack = ((float) instrument->attack - 1) / 255 *
-                         (ENVELOPE_MAX_ATTACK - ENVELOPE_MIN_ATTACK) +
-                         ENVELOPE_MIN_ATTACK;
-    const float decay = ((float) instrument->decay - 1) / 255 *
-                        (ENVELOPE_MAX_DECAY - ENVELOPE_MIN_DECAY) +
-                        ENVELOPE_MIN_DECAY;
-
-    const float sustain = ((float) instrument->sustain - 1) / 255;
-
-    const float release = ((float) instrument->release - 1) / 255 *
-                          (ENVELOPE_MAX_RELEASE - ENVELOPE_MIN_RELEASE) +
-                          ENVELOPE_MIN_RELEASE;
-
-    return envelope_gen_init(attack, decay, sustain, release);
+EnvelopeGen envelope_gen_for_instrument(
+    InstrumentSnapshot const *instrument) {
+    return envelope_gen_init(instrument->attack, instrument->decay,
+                             instrument->sustain, instrument->release);
 }
 
-void envelope_gen_trigger(EnvelopeGen *gen, float time) {
+void envelope_gen_trigger(EnvelopeGen *gen, uint64_t time) {
     if (gen->attack > 0) {
         gen->state = ENVELOPE_ATTACK;
         gen->value = 0.0;
@@ -51,12 +40,12 @@ void envelope_gen_trigger(EnvelopeGen *gen, float time) {
     gen->start = time;
 }
 
-float envelope_gen_calculate(EnvelopeGen *gen, float time) {
+float envelope_gen_calculate(EnvelopeGen *gen, uint64_t time) {
     if (gen->state == ENVELOPE_IDLE) {
         return 0;
     }
 
-    const float delta = time - gen->start;
+    const float delta = (float)(int64_t)(time - gen->start);
     if (gen->state == ENVELOPE_ATTACK && delta >= gen->attack) {
         if (gen->decay > 0) {
             gen->state = ENVELOPE_DECAY;
@@ -96,7 +85,7 @@ float envelope_gen_calculate(EnvelopeGen *gen, float time) {
         return gen->value;
     }
 
-    if (time - gen->last == 0) {
+    if (time == gen->last) {
         return gen->value;
     }
 
@@ -119,8 +108,9 @@ float envelope_gen_calculate(EnvelopeGen *gen, float time) {
     }
 
     const float ry = target - gen->value;
-    const float rt = (gen->start + interval - time) / interval;
-    const float dt = (time - gen->last) / interval;
+    const float rt = ((float)(int64_t)(gen->start - time) + interval) /
+                     interval;
+    const float dt = (float)(int64_t)(time - gen->last) / interval;
 
     if (rt <= 0.0 || dt * envelope_factor >= rt) {
         gen->value = target;
@@ -135,10 +125,11 @@ float envelope_gen_calculate(EnvelopeGen *gen, float time) {
     return gen->value;
 }
 
-void envelope_gen_release(EnvelopeGen *gen, float time) {
+void envelope_gen_release(EnvelopeGen *gen, uint64_t time) {
     if (gen->release > 0 && gen->value > 0) {
         if (gen->state == ENVELOPE_ATTACK || gen->state == ENVELOPE_SUSTAIN ||
-            (gen->state == ENVELOPE_DECAY && time - gen->start > gen->decay)) {
+            (gen->state == ENVELOPE_DECAY &&
+             (float)(int64_t)(time - gen->start) > gen->decay)) {
             gen->state = ENVELOPE_RELEASE;
         }
     } else {
@@ -151,6 +142,70 @@ void envelope_gen_release(EnvelopeGen *gen, float time) {
     gen->released = true;
 }
 
+// Moves the envelope to the time as if it had been calculated on every
+// sample in between. Within a stage the curve is solved analytically:
+// distance to the target shrinks as (time left in the stage)^curve
+void envelope_gen_advance(EnvelopeGen *gen, uint64_t time) {
+    while (gen->state != ENVELOPE_IDLE && gen->state != ENVELOPE_SUSTAIN) {
+        float interval;
+        float target;
+        if (gen->state == ENVELOPE_ATTACK) {
+            interval = gen->attack;
+            target = 1.0;
+        } else if (gen->state == ENVELOPE_DECAY) {
+            interval = gen->decay;
+            target = gen->sustain;
+        } else {
+            interval = gen->release;
+            target = 0.0;
+        }
+
+        // stage changes on the first sample past its duration
+        uint64_t end = gen->start + (uint64_t)ceil(interval);
+        if ((int64_t)(time - end) < 0) {
+            float curve = target < gen->value ? ENVELOPE_CURVE
+                                              : 1.0 / ENVELOPE_CURVE;
+            float from = interval - (float)(int64_t)(gen->last - gen->start);
+            float to = interval - (float)(int64_t)(time - gen->start);
+            if (from > 0) {
+                gen->value = target - (target - gen->value) *
+                                      powf(to / from, curve);
+            }
+            gen->last = time;
+            return;
+        }
+
+        // same transitions as in envelope_gen_calculate
+        gen->value = target;
+        if (gen->state == ENVELOPE_ATTACK) {
+            if (gen->decay > 0) {
+                gen->state = ENVELOPE_DECAY;
+            } else {
+                gen->value = gen->sustain;
+                gen->state = ENVELOPE_SUSTAIN;
+            }
+        } else if (gen->state == ENVELOPE_DECAY) {
+            if (!gen->released) {
+                gen->state = ENVELOPE_SUSTAIN;
+            } else if (gen->value > 0) {
+                gen->state = ENVELOPE_RELEASE;
+            } else {
+                gen->state = ENVELOPE_IDLE;
+            }
+        } else {
+            gen->state = ENVELOPE_IDLE;
+        }
+
+        gen->start = end;
+        gen->last = end;
+    }
+
+    if (gen->state == ENVELOPE_IDLE) {
+        gen->value = 0.0;
+    }
+    gen->last = time;
+}
+
 void envelope_gen_reset(EnvelopeGen *gen) {
     gen->last = 0;
     gen->start = 0;
@@ -161,107 +216,194 @@ void envelope_gen_reset(EnvelopeGen *gen) {
 
 // Random
 
-// thanks robn/tinysid for that
-unsigned int frand_seed;
-inline static float frand(void) {
-    frand_seed = frand_seed * 1103515245 + 12345;
-    return (float)(frand_seed >> 16);
+// thanks robn/tinysid for that, seed is kept by the note
+inline static float frand(unsigned int *seed) {
+    *seed = *seed * 1103515245 + 12345;
+    return (float)(*seed >> 16);
 }
 
+// Seed of the note is derived from its trigger only, so a note of the
+// song sounds the same however playback got to it, chunks of a parallel
+// export render their notes the same way a single pass does
+inline static unsigned int note_seed(NoteEvent const *event) {
+    uint64_t h = event->time;
+    h = h * 31 + (unsigned int)event->track;
+    h = h * 31 + (unsigned int)event->instrument;
+    h = h * 31 + (unsigned int)event->note;
+    // splitmix64 finalizer, near keys get unrelated seeds
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111eb;
+    h ^= h >> 31;
+    return (unsigned int)h;
+}
 
-// Playinh note
 
-PlayingNote *playing_note_init(State *state, int instrument, int track,
-                               int arpeggio, int note, bool song_note,
-                               float time, bool trigger, int ndx) {
-    PlayingNote *playing_note = malloc(sizeof(PlayingNote));
-    if (playing_note == NULL) {
+// Voice pool
+
+VoicePool *voice_pool_init(int cap) {
+    PlayingNote *notes = malloc(sizeof(PlayingNote) * cap);
+    if (notes == NULL) {
         return NULL;
     }
 
-    Instrument *instrument_ref = ref_list_get(state->instruments, instrument);
-    Arpeggio *arpeggio_ref = NULL;
-    if (arpeggio != -1) {
-        arpeggio_ref = ref_list_get(state->arpeggios, arpeggio);
+    PlayingNote **free_notes = malloc(sizeof(PlayingNote *) * cap);
+    if (free_notes == NULL) {
+        goto cleanup_notes;
     }
 
+    VoicePool *pool = malloc(sizeof(VoicePool));
+    if (pool == NULL) {
+        goto cleanup_free_notes;
+    }
 
-    *playing_note = (PlayingNote){
-        .instrument = instrument,
-        .track = track,
-        .arpeggio = arpeggio,
-        .note = note,
-        .song_note = song_note,
-        .time = time,
-        .state = trigger ? NOTE_STATE_TRIGGER : NOTE_STATE_RELEASE,
-        .envelope = NULL,
-        .frame = NULL,
-        .instrument_ref = instrument_ref,
-        .arpeggio_ref = arpeggio_ref,
-        .ndx = ndx,
-        .random = frand() / MAX_VALUE,
-        .sample_pos = 0};
+    *pool = (VoicePool){
+        .cap = cap,
+        .free_count = cap,
+        .notes = notes,
+        .free_notes = free_notes};
 
-    int i = 0;
-    for (; i < WIDENING_OSCILLATORS; i ++){
-        LadderFilter *filter = filter_init(SAMPLE_RATE);
-        if (filter == NULL) {
-            for (int j = 0; j < i; j ++) {
-                filter_free(playing_note->filters[j]);
-            }
-            free(playing_note);
-            return NULL;
-        }
+    // first notes are acquired first
+    for (int i = 0; i < cap; i ++) {
+        free_notes[i] = &notes[cap - i - 1];
+    }
+
+    return pool;
 
-        playing_note->filters[i] = filter;
+cleanup_free_notes:
+    free(free_notes);
+cleanup_notes:
+    free(notes);
+    return NULL;
+}
+
+PlayingNote *voice_pool_acquire(VoicePool *pool) {
+    if (pool->free_count == 0) {
+        return NULL;
     }
 
-    return playing_note;
+    pool->free_count -= 1;
+    return pool->free_notes[pool->free_count];
+}
+
+void voice_pool_release(VoicePool *pool, PlayingNote *note) {
+    pool->free_notes[pool->free_count] = note;
+    pool->free_count += 1;
+}
+
+void voice_pool_free(VoicePool *pool) {
+    free(pool->free_notes);
+    free(pool->notes);
+    free(pool);
 }
 
-void playing_note_free(PlayingNote *note) {
-    if (note->envelope != NULL) {
-        free(note->envelope);
+// Playing note
+
+PlayingNote *playing_note_init(AudioContext *ctx, NoteEvent const *event) {
+    InstrumentSnapshot *instrument_ref = snapshot_table_instrument(
+        ctx->snapshots, event->instrument);
+    if (instrument_ref == NULL) {
+        return NULL; // not published yet
     }
 
-    if (note->frame != NULL) {
-        free(note->frame);
+    // arpeggio which isn't published is not played
+    ArpeggioSnapshot *arpeggio_ref = snapshot_table_arpeggio(ctx->snapshots,
+                                                             event->arpeggio);
+
+    PlayingNote *playing_note = voice_pool_acquire(ctx->pool);
+    if (playing_note == NULL) {
+        return NULL;
     }
 
+    unsigned int seed = note_seed(event);
+    *playing_note = (PlayingNote){
+        .instrument = event->instrument,
+        .track = event->track,
+        .arpeggio = arpeggio_ref != NULL ? event->arpeggio : -1,
+        .note = event->note,
+        .song_note = event->song_note,
+        .time = event->time,
+        .state = NOTE_STATE_TRIGGER,
+        .has_frame = false,
+        .instrument_ref = instrument_ref,
+        .arpeggio_ref = arpeggio_ref,
+        .ndx = ++ctx->note_ndx,
+        .random = frand(&seed) / MAX_VALUE,
+        .sample_pos = 0,
+        .oscillators_ready = false};
+
     for (int i = 0; i < WIDENING_OSCILLATORS; i ++) {
-        filter_free(note->filters[i]);
+        playing_note->noize_values[i * 2] = frand(&seed) / MAX_VALUE;
+        playing_note->noize_values[i * 2 + 1] = 1.0;
     }
+    playing_note->noize_seed = seed;
+
+    filter_bank_reset(&playing_note->filter);
 
-    free(note);
+    return playing_note;
 }
 
-// AudioContext
+void playing_note_free(VoicePool *pool, PlayingNote *note) {
+    voice_pool_release(pool, note);
+}
 
-void typed_audio_callback(AudioContext *ctx, short* stream, int len);
+// AudioContext
 
 void audio_callback(void *ctx, Uint8* stream, int bytes) {
-    typed_audio_callback((AudioContext *)ctx, (short *)stream, bytes / 2);
+    typed_audio_callback((AudioContext *)ctx, (float *)stream,
+                         bytes / sizeof(float));
 }
 
-AudioContext *audio_context_init(State *state) {
-    RefList *buffer = ref_list_init();
+AudioContext *audio_context_init_offline(State *state, int sample_rate) {
+    // buffer never holds more notes than the pool has
+    RefList *buffer = ref_list_init_cap(VOICE_POOL_SIZE + 1);
     if (buffer == NULL) {
         return NULL;
     }
 
-    RefList *queue = ref_list_init();
-    if (queue == NULL) {
+    EventQueue *events = event_queue_init(EVENT_QUEUE_SIZE);
+    if (events == NULL) {
         goto cleanup_buffer;
     }
 
+    Scheduler *schedule = scheduler_init(MAX_SCHEDULED_EVENTS);
+    if (schedule == NULL) {
+        goto cleanup_events;
+    }
+
+    VoicePool *pool = voice_pool_init(VOICE_POOL_SIZE);
+    if (pool == NULL) {
+        goto cleanup_schedule;
+    }
+
+    Sequencer *sequencer = sequencer_init(state, sample_rate);
+    if (sequencer == NULL) {
+        goto cleanup_pool;
+    }
+
+    SnapshotTable *snapshots = snapshot_table_init(state, sample_rate);
+    if (snapshots == NULL) {
+        goto cleanup_sequencer;
+    }
+
+    if (!snapshot_table_publish_all(snapshots)) {
+        goto cleanup_snapshots;
+    }
+
     AudioContext *ctx = malloc(sizeof(AudioContext));
     if (ctx == NULL) {
-        goto cleanup_queue;
+        goto cleanup_snapshots;
+    }
+
+    pitch_table_init();
+    if (!wavetable_init()) {
+        goto cleanup;
     }
 
     SDL_AudioSpec spec = (SDL_AudioSpec){
-        .freq = SAMPLE_RATE,
-        .format = AUDIO_S16,
+        .freq = sample_rate,
+        .format = AUDIO_F32SYS,
         .channels = 2,
         .samples = SAMPLE_BUFFER,
         .callback = audio_callback,
@@ -271,86 +413,95 @@ AudioContext *audio_context_init(State *state) {
     *ctx = (AudioContext){
         .state = state,
         .buffer = buffer,
-        .queue = queue,
+        .events = events,
+        .schedule = schedule,
+        .sequencer = sequencer,
+        .snapshots = snapshots,
+        .pool = pool,
         .spec = spec,
+        .sample_rate = sample_rate,
         .sample_pos = 0,
-        .time = 0,
         .start_bar = 0,
-        .start_time = 0,
+        .start_pos = 0,
         .playing = false,
-        .update_buffer_at = -1,
-        .update_frames_at = -1,
-        .update_request_mutex = PTHREAD_MUTEX_INITIALIZER,
-        .queue_mutex = PTHREAD_MUTEX_INITIALIZER,
         .frames_update_count = 0,
         .buffer_update_count = 0,
-        .note_ndx = 0};
-
-    for (int i = 0; i < MAX_TRACKS * MAX_PATTERN_VOICES + 1; i ++) {
-        for (int j = 0; j < WIDENING_OSCILLATORS; j++) {
-            ctx->noize_values[i][j * 2] = frand();
-            ctx->noize_values[i][j * 2 + 1] = 1.0;
-        }
-    }
-
-    if (SDL_OpenAudio(&ctx->spec, NULL) < 0) {
-        goto cleanup;
-    }
+        .active_voices = 0,
+        .note_ndx = 0,
+        .device = 0,
+        .workers = NULL,
+        .track_count = 0,
+        .block = 0};
+    atomic_init(&ctx->clock, 0);
+    atomic_init(&ctx->next_track, 0);
+    atomic_init(&ctx->dropped_notes, 0);
+    filter_table_init(&ctx->filter_table, sample_rate);
 
     return ctx;
 
 cleanup:
     free(ctx);
-cleanup_queue:
-    ref_list_free(queue);
+cleanup_snapshots:
+    snapshot_table_free(snapshots);
+cleanup_sequencer:
+    sequencer_free(sequencer);
+cleanup_pool:
+    voice_pool_free(pool);
+cleanup_schedule:
+    scheduler_free(schedule);
+cleanup_events:
+    event_queue_free(events);
 cleanup_buffer:
     ref_list_free(buffer);
     return NULL;
 }
 
-inline static void audio_context_request_buffer_update(AudioContext *ctx,
-                                                       int at) {
-    if (at == ctx->update_buffer_at) {
-        return;
+AudioContext *audio_context_init(State *state, int sample_rate,
+                                 int buffer) {
+    AudioContext *ctx = audio_context_init_offline(state, sample_rate);
+    if (ctx == NULL) {
+        return NULL;
     }
 
-    pthread_mutex_lock(&ctx->update_request_mutex);
-    if (ctx->update_buffer_at != -1) {
-        ctx->update_buffer_at = MIN(ctx->update_buffer_at, at);
-    } else {
-        ctx->update_buffer_at = at;
+    // device may run at another rate or buffer size, but never
+    // in another format, as the callback writes float samples
+    SDL_AudioSpec desired = ctx->spec;
+    desired.samples = buffer;
+    ctx->device = SDL_OpenAudioDevice(NULL, false, &desired, &ctx->spec,
+                                      SDL_AUDIO_ALLOW_FREQUENCY_CHANGE |
+                                      SDL_AUDIO_ALLOW_SAMPLES_CHANGE);
+    if (ctx->device == 0) {
+        audio_context_free(ctx);
+        return NULL;
     }
-    pthread_mutex_unlock(&ctx->update_request_mutex);
-}
 
-inline static void audio_context_request_frames_update(AudioContext *ctx,
-                                                       int at) {
-    if (at == ctx->update_frames_at) {
-        return;
+    // device starts paused, nothing is rendered at the old rate yet
+    ctx->sample_rate = ctx->spec.freq;
+    ctx->sequencer->sample_rate = ctx->spec.freq;
+    ctx->snapshots->sample_rate = ctx->spec.freq;
+    filter_table_init(&ctx->filter_table, ctx->spec.freq);
+    if (!snapshot_table_publish_all(ctx->snapshots)) {
+        audio_context_free(ctx);
+        return NULL;
     }
 
-    pthread_mutex_lock(&ctx->update_request_mutex);
-    if (ctx->update_frames_at != -1) {
-        ctx->update_frames_at = MIN(ctx->update_frames_at, at);
-    } else {
-        ctx->update_frames_at = at;
-    }
-    pthread_mutex_unlock(&ctx->update_request_mutex);
+    return ctx;
 }
 
-inline static bool audio_context_need_buffer_update(AudioContext *ctx) {
-    int at = ctx->update_buffer_at;
-    return at != -1 && ctx->sample_pos >= at;
-}
+static void audio_context_render_tracks(void *arg, int worker);
 
-inline static bool audio_context_need_frames_update(AudioContext *ctx) {
-    int at = ctx->update_frames_at;
-    return at != -1 && ctx->sample_pos >= at;
-}
+bool audio_context_start_workers(AudioContext *ctx, int threads) {
+    // the audio thread waits for the workers spinning,
+    // so there is no point in having more of them than CPUs
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = MIN(threads, MIN(cpus, AUDIO_MAX_THREADS));
+    if (ctx->workers != NULL || threads <= 1) {
+        return ctx->workers != NULL || threads == 1;
+    }
 
-bool audio_context_fill_queue(AudioContext *ctx) {
-    // TODO
-    return false;
+    ctx->workers = worker_pool_init(threads - 1, audio_context_render_tracks,
+                                    ctx);
+    return ctx->workers != NULL;
 }
 
 void audio_context_play(AudioContext *ctx, int start_bar) {
@@ -358,19 +509,29 @@ void audio_context_play(AudioContext *ctx, int start_bar) {
         return;
     }
 
-    ctx->sample_pos = 0;
     ctx->start_bar = start_bar;
-    ctx->start_time = ctx->time;
+    ctx->start_pos = atomic_load_explicit(&ctx->clock, memory_order_acquire);
     ctx->playing = true;
 
-    audio_context_request_buffer_update(ctx, 0);
-
-    audio_context_fill_queue(ctx);
-    SDL_PauseAudio(false);
+    // song is sequenced by the audio callback, bars edited
+    // while it was stopped are compiled again as they are reached
+    timeline_invalidate(ctx->sequencer->timeline);
+
+    // notes sounding at the start are found here, as the bars before
+    // it may be far too many to compile in the callback
+    NoteEvent events[SEQUENCER_MAX_CHASED + 1];
+    events[0] = (NoteEvent){
+        .type = NOTE_EVENT_PLAY,
+        .time = ctx->start_pos,
+        .bar = start_bar};
+    int count = sequencer_chase(ctx->sequencer, start_bar, ctx->start_pos,
+                                events + 1);
+    event_queue_push(ctx->events, events, count + 1);
+    if (ctx->device) {
+        SDL_PauseAudioDevice(ctx->device, false);
+    }
 }
 
-int track = 0;
-
 bool audio_context_trigger_step(AudioContext *ctx, int instrument,
                                 int arpeggio, int note, int step,
                                 int step_div) {
@@ -380,912 +541,1172 @@ bool audio_context_trigger_step(AudioContext *ctx, int instrument,
 
     int track = MAX_TRACKS * MAX_PATTERN_VOICES; // last solo track
 
-    PlayingNote *trigger = playing_note_init(ctx->state, instrument - 1,
-                                             track, arpeggio - 1, note - 1,
-                                             false, ctx->time, true,
-                                             ++ctx->note_ndx);
-    if (trigger == NULL) {
-        return false;
-    }
-
     float whole = 4.0 * 60.0 / ((float)(ctx->state->song->bpm - 1));
-    float end = ctx->time + whole * step / step_div;
-    PlayingNote *release = playing_note_init(ctx->state, instrument - 1,
-                                             track, arpeggio - 1, note - 1,
-                                             false, end, false,
-                                             ++ctx->note_ndx);
-    if (release == NULL) {
-        goto cleanup_trigger;
-    }
-
-    pthread_mutex_lock(&ctx->queue_mutex);
-
-    if (!ref_list_add(ctx->queue, trigger)) {
-        goto cleanup;
-    }
+    uint64_t time = atomic_load_explicit(&ctx->clock, memory_order_acquire);
+    uint64_t length = lround(whole * step / step_div * ctx->sample_rate);
+    NoteEvent events[2] = {
+        (NoteEvent){
+            .type = NOTE_EVENT_TRIGGER,
+            .time = time,
+            .instrument = instrument - 1,
+            .track = track,
+            .arpeggio = arpeggio - 1,
+            .note = note - 1,
+            .song_note = false},
+        (NoteEvent){
+            .type = NOTE_EVENT_RELEASE,
+            .time = time + length,
+            .instrument = instrument - 1,
+            .track = track,
+            .arpeggio = arpeggio - 1,
+            .note = note - 1,
+            .song_note = false}};
+
+    // audio callback picks them up at the start of the next block
+    return event_queue_push(ctx->events, events, 2);
+}
 
-    // TODO bin search
-    int i = ctx->queue->length - 2;
-    for (;i >= 0; i--) {
-        PlayingNote *ex = ref_list_get(ctx->queue, i);
-        if (ex->time > release->time) {
-            break;
-        }
+void audio_context_stop(AudioContext *ctx) {
+    if (!ctx->playing) {
+        return;
     }
 
-    if (!ref_list_insert(ctx->queue, i + 1, release)) {
-        goto cleanup;
+    // TODO pause only in audio callback to avoid buffering after pause
+    if (ctx->device) {
+        SDL_PauseAudioDevice(ctx->device, true);
     }
+    ctx->playing = false;
+    ctx->start_pos = 0;
 
-    // update immediatelly
-    audio_context_request_buffer_update(ctx, ctx->sample_pos);
+    // song notes are dropped by the audio callback
+    NoteEvent stop = (NoteEvent){ .type = NOTE_EVENT_STOP };
+    event_queue_push(ctx->events, &stop, 1);
+}
 
-    pthread_mutex_unlock(&ctx->queue_mutex);
+void audio_context_invalidate_bar(AudioContext *ctx, int bar) {
+    if (bar == -1) {
+        timeline_invalidate(ctx->sequencer->timeline);
+    } else {
+        timeline_invalidate_bar(ctx->sequencer->timeline, bar);
+    }
+}
 
-    return true;
+void audio_context_invalidate_pattern(AudioContext *ctx, int pattern) {
+    timeline_invalidate_pattern(ctx->sequencer->timeline, pattern);
+}
 
-cleanup:
-    pthread_mutex_unlock(&ctx->queue_mutex);
-    playing_note_free(release);
-cleanup_trigger:
-    playing_note_free(trigger);
-    return false;
+bool audio_context_update_instrument(AudioContext *ctx, int n) {
+    if (n == -1) {
+        return snapshot_table_publish_all(ctx->snapshots);
+    }
+    return snapshot_table_publish_instrument(ctx->snapshots, n);
 }
 
-void audio_context_stop(AudioContext *ctx) {
-    if (!ctx->playing) {
-        return;
+bool audio_context_update_arpeggio(AudioContext *ctx, int n) {
+    if (n == -1) {
+        return snapshot_table_publish_all(ctx->snapshots);
     }
+    return snapshot_table_publish_arpeggio(ctx->snapshots, n);
+}
 
-    // TODO pause only in audio callback to avoid buffering after pause
-    SDL_PauseAudio(true);
-    ctx->playing = false;
-    ctx->sample_pos = 0;
-    ctx->start_time = 0;
+void audio_context_free(AudioContext *ctx) {
+    if (ctx->device) {
+        SDL_CloseAudioDevice(ctx->device);
+    }
+    if (ctx->workers != NULL) {
+        worker_pool_free(ctx->workers);
+    }
+    ref_list_free(ctx->buffer);
+    event_queue_free(ctx->events);
+    scheduler_free(ctx->schedule);
+    sequencer_free(ctx->sequencer);
+    snapshot_table_free(ctx->snapshots);
+    voice_pool_free(ctx->pool);
+    free(ctx);
+}
 
-    // never update
-    audio_context_request_buffer_update(ctx, -1);
-    audio_context_request_frames_update(ctx, -1);
+void audio_context_release_same_track_note(AudioContext *ctx,
+                                           NoteEvent const *event) {
+    int tn = event->track;
+    int in = event->instrument;
 
-    for (int i = 0; i < ctx->buffer->length; i++) {
-        PlayingNote *note = ref_list_get(ctx->buffer, i);
-        if (note->song_note) {
-            playing_note_free(note);
+    for (int i = 0; i < ctx->buffer->length; i ++) {
+        PlayingNote *ex = ref_list_get(ctx->buffer, i);
+        if (ex->track == tn && ex->instrument == in) {
+            playing_note_free(ctx->pool, ex);
             ref_list_del(ctx->buffer, i);
-            i -= 1;
+            break;
         }
     }
+}
 
-    pthread_mutex_lock(&ctx->queue_mutex);
+static bool is_not_song_event(NoteEvent const *event) {
+    return !event->song_note;
+}
 
-    for (int i = 0; i < ctx->queue->length; i++) {
-        PlayingNote *note = ref_list_get(ctx->queue, i);
+void audio_context_drop_song_notes(AudioContext *ctx) {
+    for (int i = 0; i < ctx->buffer->length; i++) {
+        PlayingNote *note = ref_list_get(ctx->buffer, i);
         if (note->song_note) {
-            playing_note_free(note);
-            ref_list_del(ctx->queue, i);
+            playing_note_free(ctx->pool, note);
+            ref_list_del(ctx->buffer, i);
             i -= 1;
         }
     }
 
-    pthread_mutex_unlock(&ctx->queue_mutex);
+    scheduler_filter(ctx->schedule, is_not_song_event);
 }
 
-void audio_context_free(AudioContext *ctx) {
-    SDL_CloseAudio();
-    for (int i = 0; i < ctx->buffer->length; i++) {
-        PlayingNote *n = ref_list_get(ctx->buffer, i);
-        if (n != NULL) {
-            playing_note_free(n);
-        }
-    }
-    ref_list_free(ctx->buffer);
+static void audio_context_chase_note(AudioContext *ctx,
+                                     NoteEvent const *event);
 
-    for (int i = 0; i < ctx->queue->length; i++) {
-        PlayingNote *n = ref_list_get(ctx->queue, i);
-        if (n != NULL) {
-            playing_note_free(n);
+// Releases notes of the event's instrument on its track
+static void audio_context_release_note(AudioContext *ctx,
+                                       NoteEvent const *event) {
+    for (int i = 0; i < ctx->buffer->length; i ++) {
+        PlayingNote *ex = ref_list_get(ctx->buffer, i);
+        if (ex->track == event->track &&
+            ex->instrument == event->instrument) {
+            envelope_gen_release(&ex->envelope, event->time);
         }
     }
-    ref_list_free(ctx->queue);
-
-    free(ctx);
 }
 
-void audio_context_offset_time(AudioContext *ctx, float offset) {
-    if (ctx->time - offset <= 0) {
+// Schedule is private to the audio thread. Note-ons leave room for
+// releases and are dropped once it runs out, so a note never starts
+// without a way to stop it. A release which still doesn't fit
+// is applied at the current sample rather than leaving its voice stuck on
+static void audio_context_schedule(AudioContext *ctx,
+                                   NoteEvent const *event) {
+    Scheduler *schedule = ctx->schedule;
+    if (event->type == NOTE_EVENT_TRIGGER &&
+        schedule->cap - schedule->length <= SCHEDULE_RELEASE_RESERVE) {
+        atomic_fetch_add_explicit(&ctx->dropped_notes, 1,
+                                  memory_order_relaxed);
         return;
     }
 
-    ctx->start_time -= offset;
-    ctx->time -= offset;
+    if (!scheduler_push(schedule, event) &&
+        event->type == NOTE_EVENT_RELEASE) {
+        NoteEvent now = *event;
+        now.time = ctx->sample_pos;
+        audio_context_release_note(ctx, &now);
+    }
+}
 
-    for(int i = 0; i < ctx->buffer->length; i ++) {
-        PlayingNote *note = ref_list_get(ctx->buffer, i);
-        note->time -= offset;
-        note->envelope->start -= offset;
-        note->envelope->last -= offset;
+// Moves events pushed by the UI thread to the schedule
+void audio_context_receive_events(AudioContext *ctx) {
+    NoteEvent event;
+    while (event_queue_pop(ctx->events, &event)) {
+        if (event.type == NOTE_EVENT_PLAY) {
+            sequencer_start(ctx->sequencer, event.bar, event.time);
+        } else if (event.type == NOTE_EVENT_CHASE) {
+            audio_context_chase_note(ctx, &event);
+        } else if (event.type == NOTE_EVENT_STOP) {
+            sequencer_stop(ctx->sequencer);
+            audio_context_drop_song_notes(ctx);
+        } else {
+            audio_context_schedule(ctx, &event);
+        }
     }
+}
+
+void audio_context_play_offline(AudioContext *ctx, int start_bar,
+                                double pos) {
+    ctx->sample_pos = llround(pos);
+    atomic_store_explicit(&ctx->clock, ctx->sample_pos, memory_order_release);
+
+    ctx->start_bar = start_bar;
+    ctx->start_pos = ctx->sample_pos;
+    ctx->playing = true;
 
-    pthread_mutex_lock(&ctx->queue_mutex);
+    timeline_invalidate(ctx->sequencer->timeline);
+    sequencer_start(ctx->sequencer, start_bar, pos);
 
-    for(int i = 0; i < ctx->queue->length; i ++) {
-        PlayingNote *note = ref_list_get(ctx->queue, i);
-        note->time -= offset;
+    NoteEvent notes[SEQUENCER_MAX_CHASED];
+    int count = sequencer_chase(ctx->sequencer, start_bar, ctx->sample_pos,
+                                notes);
+    for (int i = 0; i < count; i ++) {
+        audio_context_chase_note(ctx, &notes[i]);
     }
+}
 
-    pthread_mutex_unlock(&ctx->queue_mutex);
+// Number of samples from the current one to the given position
+inline static int64_t audio_context_samples_until(AudioContext *ctx,
+                                                  uint64_t pos) {
+    return (int64_t)(pos - ctx->sample_pos);
 }
 
-void audio_context_release_same_track_note(AudioContext *ctx,
-                                           PlayingNote *note) {
-    int tn = note->track;
-    int in = note->instrument;
+// Applies all events due at the current sample
+bool audio_context_fill_buffer(AudioContext *ctx) {
+    bool updated = false;
 
-    for (int i = 0; i < ctx->buffer->length; i ++) {
-        PlayingNote *ex = ref_list_get(ctx->buffer, i);
-        if (ex->track == tn && ex->instrument == in) {
-            playing_note_free(ex);
-            ref_list_del(ctx->buffer, i);
+    NoteEvent *next;
+    while((next = scheduler_peek(ctx->schedule)) != NULL) {
+        if (audio_context_samples_until(ctx, next->time) > 0) {
             break;
         }
-    }
-}
 
-bool audio_context_fill_buffer(AudioContext *ctx) {
-    ctx->buffer_update_count += 1;
-    audio_context_request_buffer_update(ctx, -1);
-    pthread_mutex_lock(&ctx->queue_mutex);
-    if (ctx->queue->length > 0) {
-        PlayingNote *last = ref_list_get(ctx->queue, ctx->queue->length - 1);
-        if (last->time > ctx->time) {
-            int dst = ceil((last->time - ctx->time) * SAMPLE_RATE + 2);
-            audio_context_request_buffer_update(ctx, ctx->sample_pos + dst);
-            pthread_mutex_unlock(&ctx->queue_mutex);
-            return false;
-        }
-    }
+        NoteEvent current;
+        scheduler_pop(ctx->schedule, &current);
+        NoteEvent *event = &current;
 
+        if (event->type == NOTE_EVENT_TRIGGER) {
+            audio_context_release_same_track_note(ctx, event);
 
-    bool updated = false;
+            PlayingNote *note = playing_note_init(ctx, event);
+            if (note == NULL) {
+                continue; // out of voices
+            }
 
-    while(ctx->queue->length > 0) {
-        PlayingNote *note = ref_list_pop(ctx->queue);
-        if (note->time <= ctx->time) {
-            if (note->state == NOTE_STATE_TRIGGER) {
-                audio_context_release_same_track_note(ctx, note);
+            note->envelope = envelope_gen_for_instrument(
+                note->instrument_ref);
+            note->state = NOTE_STATE_PLAY;
+            note->sample_pos = ctx->sample_pos;
+            ref_list_add(ctx->buffer, note);
 
-                EnvelopeGen *envelope = malloc(sizeof(EnvelopeGen));
-                if (envelope == NULL) {
-                    pthread_mutex_unlock(&ctx->queue_mutex);
-                    return false;
-                }
+            envelope_gen_trigger(&note->envelope, note->time);
 
-                Instrument *instrument = ref_list_get(ctx->state->instruments,
-                                                      note->instrument);
-               *envelope = envelope_gen_for_instrument(instrument);
-
-                note->envelope = envelope;
-                note->state = NOTE_STATE_PLAY;
-                note->sample_pos = ctx->sample_pos;
-                ref_list_add(ctx->buffer, note);
-
-                envelope_gen_trigger(envelope, note->time);
-
-                updated = true;
-            } else if (note->state == NOTE_STATE_RELEASE) {
-                for (int i = 0; i < ctx->buffer->length; i ++) {
-                    PlayingNote *ex = ref_list_get(ctx->buffer, i);
-                    if (ex->track == note->track &&
-                        ex->instrument == note->instrument) {
-                        envelope_gen_release(ex->envelope, note->time);
-                    }
-                }
-                updated = true;
-            }
-        } else {
-            ref_list_add(ctx->queue, note);
-            int dst = ceil((note->time - ctx->time) * SAMPLE_RATE + 2);
-            audio_context_request_buffer_update(ctx, ctx->sample_pos + dst);
-            break;
+            updated = true;
+        } else if (event->type == NOTE_EVENT_RELEASE) {
+            audio_context_release_note(ctx, event);
+            updated = true;
         }
     }
 
-    pthread_mutex_unlock(&ctx->queue_mutex);
     return updated;
 }
 
-inline static float calc_op(Operator op, float prev, float value) {
-    if (op == OPERATOR_EQ) {
-        return value;
-    } else if (op == OPERATOR_ADD) {
-        return prev + value;
-    } else if (op == OPERATOR_QADD) {
-        return prev + value / 4.;
-    } else if (op == OPERATOR_SUB) {
-        return prev - value;
-    } else if (op == OPERATOR_QSUB) {
-        return prev - value / 4.;
-    }
-    return value;
-}
-
+// Frames of the first pass are taken from the snapshot, repeated
+// sequences start over, others keep applying their last step
 WaveFrame audio_context_calculate_wave_frame(AudioContext *ctx,
                                              PlayingNote *note,
-                                             WaveFrame *previous) {
-    Song *song = ctx->state->song;
-    Instrument *instrument = note->instrument_ref;
-
-    Wave *wave = &instrument->wave;
-    volatile WaveFrame *prev = previous;
+                                             WaveFrame *previous,
+                                             uint64_t pos) {
+    WaveSnapshot *wave = &note->instrument_ref->wave;
     int step_n = previous != NULL ? previous->step_n + 1 : 0;
-    if (step_n >= wave->length) {
-        if (wave->repeat) {
-            step_n %= wave->length;
-            if (step_n == 0) {
-                prev = NULL;
-            }
-        } else {
-            step_n = wave->length - 1;
-        }
+
+    WaveFrame frame;
+    if (step_n < wave->length) {
+        frame = wave->frames[step_n];
+    } else if (wave->repeat) {
+        frame = wave->frames[step_n % wave->length];
+    } else {
+        frame = wave_frame_apply(wave, wave->length - 1, previous);
     }
 
-    volatile WaveStep *step = &wave->steps[step_n];
-
-    float prev_ring_mod = prev != NULL
-                             ? prev->ring_mod
-                             : INITIAL_RING_MOD - 1;
-    float ring_mod = calc_op(step->ring_mod_operator,
-                                prev_ring_mod,
-                                step->ring_mod - 1);
-    ring_mod = CLAMP(ring_mod, MIN_RING_MOD - 1, MAX_RING_MOD - 1);
-
-    float prev_ring_mod_amount = prev != NULL
-                             ? prev->ring_mod_amount
-                             : NORM(INITIAL_RING_MOD_AMOUNT,
-                                    MIN_RING_MOD_AMOUNT,
-                                    MAX_RING_MOD_AMOUNT);
-
-    float ring_mod_amount = calc_op(step->ring_mod_amount_operator,
-                                prev_ring_mod_amount,
-                                NORM(step->ring_mod_amount,
-                                     MIN_RING_MOD_AMOUNT,
-                                     MAX_RING_MOD_AMOUNT));
-
-    ring_mod_amount = NORM(ring_mod_amount, 0, 1);
-
-    float prev_hard_sync = prev != NULL
-                             ? prev->hard_sync
-                             : INITIAL_HARD_SYNC - 1;
-    float hard_sync = calc_op(step->hard_sync_operator,
-                                prev_hard_sync,
-                                step->hard_sync - 1);
-    hard_sync = CLAMP(hard_sync, MIN_HARD_SYNC - 1, MAX_HARD_SYNC - 1);
-
-    float prev_pulse_width = prev != NULL
-                             ? prev->pulse_width
-                             : NORM(INITIAL_PULSE_WIDTH,
-                                    MIN_PULSE_WIDTH,
-                                    MAX_PULSE_WIDTH);
-
-    float pulse_width = calc_op(step->pulse_width_operator,
-                                prev_pulse_width,
-                                NORM(step->pulse_width,
-                                     MIN_PULSE_WIDTH,
-                                     MAX_PULSE_WIDTH));
-
-    float duration = (float)SAMPLE_RATE * 240.0 / ((wave->step - 1) *
-                     (song->bpm - 1));
-
-    return (WaveFrame){
-        .sample_pos = ctx->sample_pos,
-        .duration = duration,
-        .step_n = step_n,
-        .form = step->form,
-        .ring_mod = ring_mod,
-        .ring_mod_amount = ring_mod_amount,
-        .hard_sync = hard_sync,
-        .pulse_width = pulse_width};
+    frame.sample_pos = pos;
+    return frame;
 }
 
 FilterFrame audio_context_calculate_filter_frame(AudioContext *ctx,
                                                  PlayingNote *note,
-                                                 FilterFrame *previous) {
-    Song *song = ctx->state->song;
-    Instrument *instrument = note->instrument_ref;
-
-    Filter *filter = &instrument->filter;
+                                                 FilterFrame *previous,
+                                                 uint64_t pos) {
+    FilterSnapshot *filter = &note->instrument_ref->filter;
     int step_n = previous != NULL ? previous->step_n + 1 : 0;
 
-    volatile FilterFrame *prev = previous;
-    if (step_n >= filter->length) {
-        if (filter->repeat) {
-            step_n %= filter->length;
-            if (step_n == 0) {
-                prev = NULL;
-            }
-        } else {
-            step_n = filter->length - 1;
-        }
+    FilterFrame frame;
+    if (step_n < filter->length) {
+        frame = filter->frames[step_n];
+    } else if (filter->repeat) {
+        frame = filter->frames[step_n % filter->length];
+    } else {
+        frame = filter_frame_apply(filter, filter->length - 1, previous);
     }
 
-    volatile FilterStep *step = &filter->steps[step_n];
-
-    float prev_resonance = prev != NULL
-                             ? prev->resonance
-                             : NORM(INITIAL_RESONANCE,
-                                    MIN_RESONANCE,
-                                    MAX_RESONANCE);
-
-    float resonance = calc_op(step->resonance_operator,
-                                prev_resonance,
-                                NORM(step->resonance,
-                                     MIN_RESONANCE,
-                                     MAX_RESONANCE));
-
-    resonance = NORM(resonance, 0, 1);
-
-    float prev_cutoff = prev != NULL
-                             ? prev->cutoff
-                             : NORM(INITIAL_CUTOFF,
-                                    MIN_CUTOFF,
-                                    MAX_CUTOFF);
-
-    float cutoff = calc_op(step->cutoff_operator,
-                                prev_cutoff,
-                                NORM(step->cutoff,
-                                     MIN_CUTOFF,
-                                     MAX_CUTOFF));
-    cutoff = NORM(cutoff, 0, 1);
-
-    float duration = (float)SAMPLE_RATE * 240.0 / ((filter->step - 1) *
-                   (song->bpm - 1));
-
-    return (FilterFrame){
-        .sample_pos = ctx->sample_pos,
-        .duration = duration,
-        .step_n = step_n,
-        .resonance = resonance,
-        .cutoff = cutoff};
+    frame.sample_pos = pos;
+    return frame;
 }
 
 ArpeggioFrame audio_context_calculate_arpeggio_frame(AudioContext *ctx,
                                                      PlayingNote *note,
-                                                     ArpeggioFrame *previous) {
-    Song *song = ctx->state->song;
-    Arpeggio *arpeggio = note->arpeggio_ref;
-
-    volatile ArpeggioFrame *prev = previous;
+                                                     ArpeggioFrame *previous,
+                                                     uint64_t pos) {
+    ArpeggioSnapshot *arpeggio = note->arpeggio_ref;
     int step_n = previous != NULL ? previous->step_n + 1 : 0;
-    if (step_n >= arpeggio->length) {
-        if (arpeggio->repeat) {
-            step_n %= arpeggio->length;
-            if (step_n == 0) {
-                prev = NULL;
-            }
-        } else {
-            step_n = arpeggio->length - 1;
-        }
-    }
 
-    volatile ArpeggioStep *step = &arpeggio->steps[step_n];
-
-    float prev_pitch = prev != NULL
-                             ? prev->note
-                             : note->note;
-    float pitch = calc_op(step->pitch_operator,
-                                prev_pitch,
-                                step->pitch);
-    pitch = CLAMP(pitch, 0, MAX_PITCH - 1);
-
-    float duration = (float)SAMPLE_RATE * 240.0 / ((arpeggio->step - 1) *
-                                          (song->bpm - 1));
+    float pitch;
+    if (step_n < arpeggio->length || arpeggio->repeat) {
+        step_n %= arpeggio->length;
+        pitch = arpeggio_point_pitch(arpeggio->points[step_n], note->note);
+    } else {
+        step_n = arpeggio->length - 1;
+        pitch = step_op_apply(arpeggio->steps[step_n], previous->note);
+        pitch = CLAMP(pitch, 0, MAX_PITCH - 1);
+    }
 
     return (ArpeggioFrame){
-        .sample_pos = ctx->sample_pos,
-        .duration = duration,
+        .sample_pos = pos,
+        .duration = arpeggio->duration,
         .step_n = step_n,
         .note = pitch};
 }
 
-Frame *audio_context_calculate_frame(AudioContext *ctx, PlayingNote *note) {
-    Frame *previous = note->frame;
+// samples left from pos to the end of a wave, filter or arpeggio frame
+inline static int64_t frame_part_left(uint64_t sample_pos, int duration,
+                                      uint64_t pos) {
+    return (int64_t)(sample_pos + duration - pos);
+}
+
+Frame audio_context_calculate_frame(AudioContext *ctx, PlayingNote *note) {
+    Frame *previous = note->has_frame ? &note->frame : NULL;
 
     WaveFrame wave;
     if (previous != NULL) {
         WaveFrame *prev = &previous->wave;
-        if (prev->sample_pos + prev->duration > ctx->sample_pos) {
+        if (frame_part_left(prev->sample_pos, prev->duration,
+                            ctx->sample_pos) > 0) {
             wave = *prev;
         } else {
-            wave = audio_context_calculate_wave_frame(ctx, note, prev);
+            wave = audio_context_calculate_wave_frame(ctx, note, prev,
+                                                   ctx->sample_pos);
         }
     } else {
-        wave = audio_context_calculate_wave_frame(ctx, note, NULL);
+        wave = audio_context_calculate_wave_frame(ctx, note, NULL,
+                                               ctx->sample_pos);
     }
 
 
     FilterFrame filter;
     if (previous != NULL) {
         FilterFrame *prev = &previous->filter;
-        if (prev->sample_pos + prev->duration > ctx->sample_pos) {
+        if (frame_part_left(prev->sample_pos, prev->duration,
+                            ctx->sample_pos) > 0) {
             filter = *prev;
         } else {
-            filter = audio_context_calculate_filter_frame(ctx, note, prev);
+            filter = audio_context_calculate_filter_frame(ctx, note, prev,
+                                                   ctx->sample_pos);
         }
     } else {
-        filter = audio_context_calculate_filter_frame(ctx, note, NULL);
-    }
-
-    Frame *frame = malloc(sizeof(Frame));
-    if (frame == NULL) {
-        return NULL;
+        filter = audio_context_calculate_filter_frame(ctx, note, NULL,
+                                               ctx->sample_pos);
     }
 
-    *frame = (Frame){
+    Frame frame = (Frame){
         .wave = wave,
         .filter = filter,
         .play_arpeggio = note->arpeggio != -1
     };
 
-    if (!frame->play_arpeggio) {
-        frame->note = note->note;
+    if (!frame.play_arpeggio) {
+        frame.note = note->note;
         return frame;
     }
 
     ArpeggioFrame arpeggio;
     if (previous != NULL) {
         ArpeggioFrame *prev = &previous->arpeggio;
-        if (prev->sample_pos + prev->duration > ctx->sample_pos) {
+        if (frame_part_left(prev->sample_pos, prev->duration,
+                            ctx->sample_pos) > 0) {
             arpeggio = *prev;
         } else {
-            arpeggio = audio_context_calculate_arpeggio_frame(ctx, note, prev);
+            arpeggio = audio_context_calculate_arpeggio_frame(ctx, note, prev,
+                                                   ctx->sample_pos);
         }
     } else {
-        arpeggio = audio_context_calculate_arpeggio_frame(ctx, note, NULL);
+        arpeggio = audio_context_calculate_arpeggio_frame(ctx, note, NULL,
+                                               ctx->sample_pos);
     }
 
-    frame->arpeggio = arpeggio;
+    frame.arpeggio = arpeggio;
     return frame;
 }
 
-inline static float get_min_frame_end(Frame *frame) {
+// samples left from pos to the earliest frame part end
+inline static int64_t get_frame_left(Frame *frame, uint64_t pos) {
     WaveFrame *wave = &frame->wave;
     FilterFrame *filter = &frame->filter;
     ArpeggioFrame *arp = &frame->arpeggio;
-    int wave_end = wave->sample_pos + wave->duration;
-    int filter_end = filter->sample_pos + filter->duration;
+    int64_t wave_left = frame_part_left(wave->sample_pos, wave->duration, pos);
+    int64_t filter_left = frame_part_left(filter->sample_pos,
+                                          filter->duration, pos);
     if (frame->play_arpeggio) {
-        int arp_end = arp->sample_pos + arp->duration;
-        return MIN(wave_end, MIN(filter_end, arp_end));
+        int64_t arp_left = frame_part_left(arp->sample_pos, arp->duration,
+                                           pos);
+        return MIN(wave_left, MIN(filter_left, arp_left));
     } else {
-        return MIN(wave_end, filter_end);
+        return MIN(wave_left, filter_left);
     }
 }
 
+// Calculates frames of new notes and of notes whose frame has ended
 bool audio_context_fill_frames(AudioContext *ctx) {
-    ctx->frames_update_count += 1;
-    audio_context_request_frames_update(ctx, -1);
     bool updated = false;
     for (int i = 0; i < ctx->buffer->length; i ++) {
         PlayingNote *note = ref_list_get(ctx->buffer, i);
-        Frame *prev = note->frame;
-        if (prev != NULL) {
-            int end = get_min_frame_end(prev);
-            if (end > ctx->sample_pos) {
-                int end = get_min_frame_end(prev);
-                audio_context_request_frames_update(ctx, end + 2);
-                continue; // no need for update
-            }
+        if (note->has_frame &&
+            get_frame_left(&note->frame, ctx->sample_pos) > 0) {
+            continue; // no need for update
         }
 
         updated = true;
 
-        Frame *frame = audio_context_calculate_frame(ctx, note);
-        if (frame == NULL) {
-            return false;
-        }
-
-        int end = get_min_frame_end(frame);
-        audio_context_request_frames_update(ctx, end + 2);
-
-        if (prev != NULL) {
-            free(prev);
-        }
-
-        note->frame = frame;
+        note->frame = audio_context_calculate_frame(ctx, note);
+        note->has_frame = true;
     }
 
     return updated;
 }
 
-bool audio_context_update_play_buffers(AudioContext *ctx) {
-    bool update_buffer = audio_context_need_buffer_update(ctx);
-    bool buffer_updated = false;
-    if (update_buffer) {
-        buffer_updated = audio_context_fill_buffer(ctx);
+// position of the first frame of the last whole repeat cycle before pos,
+// repeated steps start over with no history, so the frame there is
+// the same as the first one
+inline static uint64_t frame_cycle_start(uint64_t start, int duration,
+                                         int length, uint64_t pos) {
+    int64_t cycle = (int64_t)duration * length;
+    if (cycle <= 0) {
+        return start;
+    }
+    return start + (int64_t)(pos - start) / cycle * cycle;
+}
+
+// Steps frames of a note triggered before the current sample forward
+// to the ones it plays now, without rendering it
+static void audio_context_chase_frames(AudioContext *ctx, PlayingNote *note) {
+    InstrumentSnapshot *instrument = note->instrument_ref;
+    uint64_t now = ctx->sample_pos;
+
+    WaveFrame wave = audio_context_calculate_wave_frame(ctx, note, NULL,
+                                                        note->time);
+    if (instrument->wave.repeat) {
+        uint64_t start = frame_cycle_start(note->time, wave.duration,
+                                           instrument->wave.length, now);
+        wave = audio_context_calculate_wave_frame(ctx, note, NULL, start);
+    }
+    while (frame_part_left(wave.sample_pos, wave.duration, now) <= 0) {
+        wave = audio_context_calculate_wave_frame(
+            ctx, note, &wave, wave.sample_pos + wave.duration);
+    }
+
+    FilterFrame filter = audio_context_calculate_filter_frame(ctx, note, NULL,
+                                                              note->time);
+    if (instrument->filter.repeat) {
+        uint64_t start = frame_cycle_start(note->time, filter.duration,
+                                           instrument->filter.length, now);
+        filter = audio_context_calculate_filter_frame(ctx, note, NULL, start);
+    }
+    while (frame_part_left(filter.sample_pos, filter.duration, now) <= 0) {
+        filter = audio_context_calculate_filter_frame(
+            ctx, note, &filter, filter.sample_pos + filter.duration);
     }
 
-    bool update_frames = audio_context_need_frames_update(ctx);
+    Frame frame = (Frame){
+        .wave = wave,
+        .filter = filter,
+        .play_arpeggio = note->arpeggio != -1};
 
-    // fill frames if buffer update or if frames requested update
-    if (buffer_updated || update_frames) {
-        if (!audio_context_fill_frames(ctx)) {
-            return false;
+    if (!frame.play_arpeggio) {
+        frame.note = note->note;
+    } else {
+        ArpeggioSnapshot *arpeggio = note->arpeggio_ref;
+        ArpeggioFrame arp = audio_context_calculate_arpeggio_frame(
+            ctx, note, NULL, note->time);
+        if (arpeggio->repeat) {
+            uint64_t start = frame_cycle_start(note->time, arp.duration,
+                                               arpeggio->length, now);
+            arp = audio_context_calculate_arpeggio_frame(ctx, note, NULL,
+                                                         start);
         }
+        while (frame_part_left(arp.sample_pos, arp.duration, now) <= 0) {
+            arp = audio_context_calculate_arpeggio_frame(
+                ctx, note, &arp, arp.sample_pos + arp.duration);
+        }
+        frame.arpeggio = arp;
     }
 
-    return true;
+    note->frame = frame;
+    note->has_frame = true;
 }
 
+// Starts a song note which was triggered before the playback start
+// and would still sound, as if the song had been playing from
+// the beginning. Envelope and frames are fast-forwarded, not rendered
+static void audio_context_chase_note(AudioContext *ctx,
+                                     NoteEvent const *event) {
+    sequencer_hold(ctx->sequencer, event);
+    PlayingNote *note = playing_note_init(ctx, event);
+    if (note == NULL) {
+        return; // out of voices
+    }
 
+    note->envelope = envelope_gen_for_instrument(note->instrument_ref);
+    envelope_gen_trigger(&note->envelope, note->time);
+    if (event->release != UINT64_MAX) {
+        envelope_gen_advance(&note->envelope, event->release);
+        envelope_gen_release(&note->envelope, event->release);
+    }
+    envelope_gen_advance(&note->envelope, ctx->sample_pos);
 
-void audio_context_release_note(AudioContext *ctx, PlayingNote *note) {
-    for (int i = 0; i < ctx->buffer->length; i ++) {
-        PlayingNote *ex = ref_list_get(ctx->buffer, i);
-        if (ex == note) {
-            playing_note_free(ex);
-            ref_list_del(ctx->buffer, i);
-            break;
-        }
+    if (note->envelope.state == ENVELOPE_IDLE) {
+        playing_note_free(ctx->pool, note);
+        return;
     }
+
+    note->state = NOTE_STATE_PLAY;
+    note->sample_pos = note->time;
+    audio_context_chase_frames(ctx, note);
+    ref_list_add(ctx->buffer, note);
 }
 
-// Sound engine
+// Points sounding notes to the current snapshots, so edits published
+// since the last block apply to them as well
+static void audio_context_take_snapshots(AudioContext *ctx) {
+    for (int i = 0; i < ctx->buffer->length; i ++) {
+        PlayingNote *note = ref_list_get(ctx->buffer, i);
+        InstrumentSnapshot *instrument = snapshot_table_instrument(
+            ctx->snapshots, note->instrument);
+        if (instrument != NULL) {
+            note->instrument_ref = instrument;
+        }
 
-inline static float noize_wave(AudioContext *ctx, int ndx, int osc, float x) {
-    float xf = x * 2;
-    xf = xf - round(xf);
-    if (xf < ctx->noize_values[ndx][osc * 2 + 1]) {
-        ctx->noize_values[ndx][osc * 2] = frand();
+        ArpeggioSnapshot *arpeggio = snapshot_table_arpeggio(ctx->snapshots,
+                                                             note->arpeggio);
+        if (arpeggio != NULL) {
+            note->arpeggio_ref = arpeggio;
+        }
     }
-    ctx->noize_values[ndx][osc * 2 + 1] = xf;
-    return ctx->noize_values[ndx][osc * 2];
 }
 
-inline static float saw_wave(float x) {
-    return (float) MAX_VALUE - 2.0 * x * MAX_VALUE;
-}
+// Applies everything that happens at the current sample
+void audio_context_update_play_buffers(AudioContext *ctx) {
+    audio_context_take_snapshots(ctx);
+    audio_context_receive_events(ctx);
+    sequencer_fill(ctx->sequencer, ctx->schedule, ctx->sample_pos);
 
-inline static float square_wave(float pw, float x) {
-    const float o = 0.205026489;
-    float pws = o;
-    if (pws > 1.0) {
-        pws -= 1;
+    if (audio_context_fill_buffer(ctx)) {
+        ctx->buffer_update_count += 1;
     }
-    float pwe = o + pw;
-    if (pwe > 1.0) {
-        pwe -= 1;
+
+    if (audio_context_fill_frames(ctx)) {
+        ctx->frames_update_count += 1;
     }
-    if (pwe < pws) {
-        pwe += pws;
-        pws = pwe - pws;
-        pwe = pwe - pws;
+}
+
+// Returns notes which have finished playing back to the pool
+void audio_context_reclaim_voices(AudioContext *ctx) {
+    for (int i = ctx->buffer->length - 1; i >= 0; i --) {
+        PlayingNote *note = ref_list_get(ctx->buffer, i);
+        if (note->envelope.state == ENVELOPE_IDLE) {
+            playing_note_free(ctx->pool, note);
+            ref_list_del(ctx->buffer, i);
+        }
     }
-    return x >= pws && x < pwe ? 0.0 : MAX_VALUE;
+
+    ctx->active_voices = ctx->buffer->length;
 }
 
-inline static float tri_wave(float x) {
-    if (x < 0.25) {
-        return 0 + (x / 0.25) * MAX_VALUE;
-    } else if (x > 0.75) {
-        return -MAX_VALUE + (x - 0.75) / 0.25 * MAX_VALUE;
-    } else {
-        return MAX_VALUE - 2 * (x - 0.25) / 0.5 * MAX_VALUE;
+// Sound engine
+
+inline static float noize_wave(PlayingNote *note, int osc, float x) {
+    float xf = x * 2;
+    xf = xf - round(xf);
+    if (xf < note->noize_values[osc * 2 + 1]) {
+        note->noize_values[osc * 2] = frand(&note->noize_seed) / MAX_VALUE;
     }
+    note->noize_values[osc * 2 + 1] = xf;
+    return note->noize_values[osc * 2];
+}
+
+// band limited pulse, 0 inside of the pulse window and 1 outside,
+// made of two saws shifted by the window width
+inline static float square_wave(float const *saw, float pws, float pwe,
+                                float x) {
+    float a = x - pws;
+    float b = x - pwe;
+    a += a < 0 ? 1 : 0;
+    b += b < 0 ? 1 : 0;
+    float window = (wavetable_lookup(saw, a) - wavetable_lookup(saw, b) +
+                    2 * (pwe - pws)) / 2;
+    return 1 - window;
 }
 
+// forms are combined bitwise as 16 bit samples
 inline static float and_wave(float a, float b) {
-    return (float)((short)round(a) & (short)round(b));
+    // band limited forms overshoot a bit
+    a = CLAMP(a, -1.0f, 1.0f);
+    b = CLAMP(b, -1.0f, 1.0f);
+    short ab = (short)round(a * MAX_VALUE) & (short)round(b * MAX_VALUE);
+    return (float)ab / MAX_VALUE;
 }
 
-inline static float wave(AudioContext *ctx, WaveFrame *wave, int ndx,
-                         int osc, float x) {
+// saw and table are the wavetables of the oscillator's level
+inline static float wave(PlayingNote *note, WaveFrame *wave, int osc,
+                         float const *saw, float const *table, float x) {
     float result = 0.0;
+    bool first = true;
     if ((wave->form & WAVE_FORM_NOIZE) == WAVE_FORM_NOIZE) {
-        if (result == 0.0) {
-            result += noize_wave(ctx, ndx, osc, x);
-        } else {
-            result = and_wave(result, noize_wave(ctx, ndx, osc, x));
-        }
+        result = noize_wave(note, osc, x);
+        first = false;
     }
 
     if ((wave->form & WAVE_FORM_SQUARE) == WAVE_FORM_SQUARE) {
-        if (result == 0.0) {
-            result += square_wave(wave->pulse_width, x);
-        } else {
-            result = and_wave(result, square_wave(wave->pulse_width, x));
-        }
-    }
-
-    if ((wave->form & WAVE_FORM_SAW) == WAVE_FORM_SAW) {
-        if (result == 0.0) {
-            result += saw_wave(x);
-        } else {
-            result = and_wave(result, saw_wave(x));
-        }
+        float y = square_wave(saw, wave->pulse_start, wave->pulse_end, x);
+        result = first ? y : and_wave(result, y);
+        first = false;
     }
 
-    if ((wave->form & WAVE_FORM_TRI) == WAVE_FORM_TRI) {
-        if (result == 0.0) {
-            result += tri_wave(x);
-        } else {
-            result = and_wave(result, tri_wave(x));
-        }
+    // saw, tri and their combination are tabulated together
+    if (table != NULL) {
+        float y = wavetable_lookup(table, x);
+        result = first ? y : and_wave(result, y);
     }
 
     return result;
 }
 
-typedef struct {
-    float left;
-    float right;
-} Output;
-
-inline static float note_freq(float note) {
-    float ref_note = 58; // A4 440
-    float ref_freq = 440;
-    float dn = note - ref_note;
-    return ref_freq * pow(TETT, dn);
-}
-
-inline static void sync_note(PlayingNote *note, float pitch,
-                             float freq_offset, float offset, int pos) {
-        float freq_sync = note_freq(pitch) + freq_offset;
-        float cycle_sync = (float)SAMPLE_RATE / freq_sync;
-        float ts = (float)(pos + offset) / cycle_sync;
-        float nts = (float)(pos + 1 + offset) / cycle_sync;
-        float xs = ts - floor(ts);
-        float nxs = nts - floor(nts);
-
-        if (nxs < xs) {
-            note->sample_pos = pos;
-        }
+inline static float frac(float x) {
+    return x - floor(x);
 }
 
-inline static Output single_voice(AudioContext *ctx, PlayingNote *note,
-                                  int nv, float detune, float separation,
-                                  float offset) {
-    Instrument *instrument = note->instrument_ref;;
-    EnvelopeGen *envelope = note->envelope;
-    Frame *frame = note->frame;
-
+inline static Oscillator oscillator_init(float freq, float offset,
+                                         float separation, int sample_rate) {
+    float increment = freq / sample_rate;
+    float origin = frac(offset * increment + separation);
+    return (Oscillator){
+        .phase = origin,
+        .increment = increment,
+        .origin = origin,
+        .level = wavetable_level(increment)};
+}
 
-    // parameters
-    float pitch = frame->play_arpeggio ? frame->arpeggio.note : frame->note;
-    float freq_offset = (note->random - 0.5) * 2 * 0.125;
-    freq_offset = 0;
+// changes frequency of the running oscillator keeping its phase
+inline static void oscillator_retune(Oscillator *osc, Oscillator tuned) {
+    osc->increment = tuned.increment;
+    osc->origin = tuned.origin;
+    osc->level = tuned.level;
+}
 
-    if (frame->wave.hard_sync > 0) {
-        sync_note(note, pitch, freq_offset, offset, ctx->sample_pos);
+inline static float oscillator_next(Oscillator *osc) {
+    float x = osc->phase;
+    osc->phase += osc->increment;
+    if (osc->phase >= 1.0) {
+        osc->phase -= (int)osc->phase;
     }
+    return x;
+}
 
-    // TODO a lot of constant variables and expressions, preinitialize
-
-    float freq = note_freq(pitch + frame->wave.hard_sync) + freq_offset;
-    float vol = NORM((float)instrument->volume, MIN_PARAM, MAX_PARAM);
-    int nvl = nv * 2;
-    int nvr = nv * 2 + 1;
-    float pan = NORM((float)instrument->pan, MIN_PARAM, MAX_PARAM);
+inline static bool oscillator_wraps(Oscillator *osc) {
+    osc->phase += osc->increment;
+    if (osc->phase >= 1.0) {
+        osc->phase -= (int)osc->phase;
+        return true;
+    }
+    return false;
+}
 
-    // phases
-    float cycle_len_l = (float)SAMPLE_RATE / (freq - detune);
-    float cycle_len_r = (float)SAMPLE_RATE / (freq + detune);
-    float tl = (float)(ctx->sample_pos + offset - note->sample_pos) /
-               cycle_len_l + separation;
-    float tr = (float)(ctx->sample_pos + offset - note->sample_pos) /
-               cycle_len_r - separation;
-    float xl = tl - floor(tl);
-    float xr = tr - floor(tr);
+// restarts all oscillators of the note, used for hard sync
+inline static void oscillators_reset(Oscillator *oscillators, int n) {
+    for (int i = 0; i < n; i ++) {
+        oscillators[i].phase = oscillators[i].origin;
+    }
+}
 
-    // wave
-    float yl = wave(ctx, &frame->wave, note->track, nvl, xl);
-    float yr = wave(ctx, &frame->wave, note->track, nvr, xr);
+// Recalculates oscillator increments, only when the pitch of the frame
+// has changed since the last block
+inline static void note_oscillators_update(PlayingNote *note,
+                                           int sample_rate) {
+    Frame *frame = &note->frame;
+    WaveFrame *wave_frame = &frame->wave;
+    float pitch = frame->play_arpeggio ? frame->arpeggio.note : frame->note;
+    bool ring_mod = wave_frame->ring_mod_amount != 0;
 
+    if (note->oscillators_ready && note->oscillators_pitch == pitch &&
+        note->oscillators_hard_sync == wave_frame->hard_sync &&
+        note->oscillators_ring_mod == wave_frame->ring_mod &&
+        note->oscillators_ring_mod_on == ring_mod) {
+        return;
+    }
 
-    // envelope
-    float e = envelope_gen_calculate(envelope, ctx->time);
+    float rand_phase_offset = wave_frame->hard_sync == 0
+                              ? note->random * sample_rate
+                              : 0;
 
-    yl *= vol * e;
-    yr *= vol * e;
+    // single voice is not detuned
+    float freq_offset = ring_mod ? (note->random - 0.5) * 2 * 0.125 : 0;
+
+    float freq = pitch_freq(pitch + wave_frame->hard_sync) + freq_offset;
+    float ft = ring_mod
+               ? pitch_freq(pitch + wave_frame->hard_sync +
+                           wave_frame->ring_mod) + freq_offset
+               : freq;
+
+    const float detune[WIDENING_OSCILLATORS / 2] = { 0, WIDENING_DETUNE };
+    const float separation[WIDENING_OSCILLATORS / 2] = {
+        WIDENING_OFFSET / 2, WIDENING_OFFSET };
+    const float offset[WIDENING_OSCILLATORS / 2] = {
+        rand_phase_offset + 1.0 / 12., rand_phase_offset };
+
+    for (int nv = 0; nv < WIDENING_OSCILLATORS / 2; nv ++) {
+        int nvl = nv * 2;
+        int nvr = nv * 2 + 1;
+        Oscillator oscillators[4] = {
+            oscillator_init(freq - detune[nv], offset[nv], separation[nv],
+                            sample_rate),
+            oscillator_init(freq + detune[nv], offset[nv], -separation[nv],
+                            sample_rate),
+            oscillator_init(ft - detune[nv], offset[nv], separation[nv],
+                            sample_rate),
+            oscillator_init(ft + detune[nv], offset[nv], -separation[nv],
+                            sample_rate)};
+
+        if (note->oscillators_ready) {
+            oscillator_retune(&note->oscillators[nvl], oscillators[0]);
+            oscillator_retune(&note->oscillators[nvr], oscillators[1]);
+            oscillator_retune(&note->ring_mod_oscillators[nvl], oscillators[2]);
+            oscillator_retune(&note->ring_mod_oscillators[nvr], oscillators[3]);
+        } else {
+            note->oscillators[nvl] = oscillators[0];
+            note->oscillators[nvr] = oscillators[1];
+            note->ring_mod_oscillators[nvl] = oscillators[2];
+            note->ring_mod_oscillators[nvr] = oscillators[3];
+        }
+    }
 
-    // panning
+    Oscillator sync = oscillator_init(pitch_freq(pitch) + freq_offset, 0, 0,
+                                      sample_rate);
+    if (note->oscillators_ready) {
+        oscillator_retune(&note->sync_oscillator, sync);
+    } else {
+        note->sync_oscillator = sync;
+    }
 
-    float pd = abs(pan - 0.5);
-    yl *= (1 - pan) * (-pd + 1) * 2;
-    yr *= pan * (-pd + 1) * 2;
+    note->oscillators_ready = true;
+    note->oscillators_pitch = pitch;
+    note->oscillators_hard_sync = wave_frame->hard_sync;
+    note->oscillators_ring_mod = wave_frame->ring_mod;
+    note->oscillators_ring_mod_on = ring_mod;
+}
 
-    // filter
+// parameters of the whole voice, constant during the block
+typedef struct {
+    float gain_left;
+    float gain_right;
+    bool hard_sync;
+    bool ring_mod;
+    bool filter;
+} VoiceParams;
 
-    if (frame->filter.cutoff < 0.995) {
-        filter_set_cutoff(note->filters[nvl], frame->filter.cutoff * 20000);
-        filter_set_resonance(note->filters[nvl], frame->filter.resonance);
+inline static VoiceParams voice_params_init(AudioContext *ctx,
+                                            PlayingNote *note) {
+    InstrumentSnapshot *instrument = note->instrument_ref;
+    Frame *frame = &note->frame;
 
-        filter_set_cutoff(note->filters[nvr], frame->filter.cutoff * 20000);
-        filter_set_resonance(note->filters[nvr], frame->filter.resonance);
+    note_oscillators_update(note, ctx->sample_rate);
 
+    VoiceParams params = (VoiceParams){
+        .gain_left = instrument->gain_left,
+        .gain_right = instrument->gain_right,
+        .hard_sync = frame->wave.hard_sync > 0,
+        .ring_mod = frame->wave.ring_mod_amount != 0,
+        .filter = frame->filter.cutoff < 0.995};
 
-        yl = filter_process(note->filters[nvl], yl / MAX_VALUE) * MAX_VALUE;
-        yr = filter_process(note->filters[nvr], yr / MAX_VALUE) * MAX_VALUE;
+    if (params.filter) {
+        filter_bank_set(&note->filter, &ctx->filter_table,
+                        frame->filter.cutoff, frame->filter.resonance);
     }
 
-    return (Output){ .left = yl, .right = yr };
+    return params;
 }
-inline static Output ring_mod_voice(AudioContext *ctx, PlayingNote *note,
-                                    int nv, float detune, float separation,
-                                    float offset) {
-    Instrument *instrument = note->instrument_ref;
-    EnvelopeGen *envelope = note->envelope;
-    Frame *frame = note->frame;
-
-    // parameters
-    float pitch = frame->play_arpeggio ? frame->arpeggio.note : frame->note;
-    float freq_offset = (note->random - 0.5) * 2 * 0.125;
 
-    if (frame->wave.hard_sync > 0) {
-        sync_note(note, pitch, freq_offset, offset, ctx->sample_pos);
+// Renders oscillators of tabulated forms without hard sync, the same
+// as the sample loop of instrument_voice_block does, with the
+// wavetable bank kernel reading all oscillators of the voice at once
+static void voice_tables_block(Oscillator *osc, float const *const *tables,
+                               VoiceParams const *params, float rma,
+                               float const *envelope, float *lanes,
+                               float *ring_mod, int n) {
+    float phases[WAVETABLE_BANK_LANES];
+    float increments[WAVETABLE_BANK_LANES];
+    for (int l = 0; l < WAVETABLE_BANK_LANES; l ++) {
+        phases[l] = osc[l].phase;
+        increments[l] = osc[l].increment;
+    }
+    wavetable_bank_read(phases, increments, tables, lanes, n);
+    for (int l = 0; l < WAVETABLE_BANK_LANES; l ++) {
+        osc[l].phase = phases[l];
+    }
+
+    // ring mod oscillators only run while ring mod is on
+    if (params->ring_mod) {
+        Oscillator *ring = osc + WIDENING_OSCILLATORS;
+        for (int l = 0; l < WAVETABLE_BANK_LANES; l ++) {
+            phases[l] = ring[l].phase;
+            increments[l] = ring[l].increment;
+        }
+        wavetable_bank_read(phases, increments,
+                            tables + WIDENING_OSCILLATORS, ring_mod, n);
+        for (int l = 0; l < WAVETABLE_BANK_LANES; l ++) {
+            ring[l].phase = phases[l];
+        }
     }
 
-    float freq = note_freq(pitch + frame->wave.hard_sync);
-    float ft = note_freq(pitch + frame->wave.hard_sync + frame->wave.ring_mod);
-    float fb = freq;
+    for (int i = 0; i < n; i ++) {
+        float *frame = lanes + i * WIDENING_OSCILLATORS;
+        float const *ring_frame = ring_mod + i * WIDENING_OSCILLATORS;
+        for (int l = 0; l < WIDENING_OSCILLATORS; l ++) {
+            float y = frame[l];
+            if (params->ring_mod) {
+                y = y * (1 - rma) + ring_frame[l] * y * rma;
+            }
 
-    freq += freq_offset;
-    fb += freq_offset;
-    ft += freq_offset;
+            // even oscillators go left, odd ones right
+            float gain = l % 2 == 0 ? params->gain_left : params->gain_right;
+            frame[l] = y * (gain * envelope[i]);
+        }
+    }
+}
 
-    float vol = NORM((float)instrument->volume, MIN_PARAM, MAX_PARAM);
-    int nvl = nv * 2;
-    int nvr = nv * 2 + 1;
-    float pan = NORM((float)instrument->pan, MIN_PARAM, MAX_PARAM);
+// Renders n samples of the note into the left and right scratch buffers,
+// frame of the note is expected to stay the same during the block
+void instrument_voice_block(AudioContext *ctx, PlayingNote *note,
+                            uint64_t pos, int n, VoiceScratch *scratch) {
+    VoiceParams params = voice_params_init(ctx, note);
+    WaveFrame *wave_frame = &note->frame.wave;
+    float rma = wave_frame->ring_mod_amount;
+    float *envelope = scratch->envelope;
+    float *lanes = scratch->lanes;
+    float *left = scratch->left;
+    float *right = scratch->right;
+
+    for (int i = 0; i < n; i ++) {
+        envelope[i] = envelope_gen_calculate(&note->envelope, pos + i);
+    }
+
+    // oscillators are kept in locals during the block, so their state
+    // isn't reloaded after every store to the output,
+    // main oscillators go first, ring mod ones after them
+    const int count = WIDENING_OSCILLATORS * 2;
+    Oscillator osc[WIDENING_OSCILLATORS * 2];
+    Oscillator sync = note->sync_oscillator;
+    memcpy(osc, note->oscillators, sizeof(note->oscillators));
+    memcpy(osc + WIDENING_OSCILLATORS, note->ring_mod_oscillators,
+           sizeof(note->ring_mod_oscillators));
+
+    float const *saws[WIDENING_OSCILLATORS * 2];
+    float const *tables[WIDENING_OSCILLATORS * 2];
+    for (int i = 0; i < count; i ++) {
+        saws[i] = wavetable_get(WAVETABLE_SAW, osc[i].level);
+        tables[i] = wave_frame->table != WAVETABLE_NONE
+                    ? wavetable_get(wave_frame->table, osc[i].level)
+                    : NULL;
+    }
+
+    // oscillators are filtered together after the whole block,
+    // each one in its own lane of the bank
+    bool tabulated = wave_frame->table != WAVETABLE_NONE &&
+                     !(wave_frame->form & (WAVE_FORM_NOIZE |
+                                           WAVE_FORM_SQUARE));
+    if (tabulated && !params.hard_sync) {
+        voice_tables_block(osc, tables, &params, rma, envelope, lanes,
+                           scratch->ring_mod, n);
+    } else {
+        for (int i = 0; i < n; i ++) {
+            float *frame = lanes + i * WIDENING_OSCILLATORS;
 
-    // phases
-    float cycle_len_l = (float)SAMPLE_RATE / (freq - detune);
-    float cycle_len_lb = (float)SAMPLE_RATE / (fb - detune);
-    float cycle_len_lt = (float)SAMPLE_RATE / (ft - detune);
-    float cycle_len_r = (float)SAMPLE_RATE / (freq + detune);
-    float cycle_len_rb = (float)SAMPLE_RATE / (fb + detune);
-    float cycle_len_rt = (float)SAMPLE_RATE / (ft + detune);
+            if (params.hard_sync && oscillator_wraps(&sync)) {
+                oscillators_reset(osc, count);
+            }
 
-    float tl = (float)(ctx->sample_pos + offset - note->sample_pos) /
-               cycle_len_l + separation;
+            for (int nv = 0; nv < WIDENING_OSCILLATORS / 2; nv ++) {
+                int nvl = nv * 2;
+                int nvr = nv * 2 + 1;
+                float yl = wave(note, wave_frame, nvl, saws[nvl], tables[nvl],
+                                oscillator_next(&osc[nvl]));
+                float yr = wave(note, wave_frame, nvr, saws[nvr], tables[nvr],
+                                oscillator_next(&osc[nvr]));
+
+                if (params.ring_mod) {
+                    // ring mod base oscillator has the same frequency and phase
+                    // as the main one, so main output is reused for it
+                    int nvlt = WIDENING_OSCILLATORS + nvl;
+                    int nvrt = WIDENING_OSCILLATORS + nvr;
+                    float ylt = wave(note, wave_frame, nvl, saws[nvlt],
+                                     tables[nvlt], oscillator_next(&osc[nvlt]));
+                    float yrt = wave(note, wave_frame, nvr, saws[nvrt],
+                                     tables[nvrt], oscillator_next(&osc[nvrt]));
+
+                    yl = yl * (1 - rma) + ylt * yl * rma;
+                    yr = yr * (1 - rma) + yrt * yr * rma;
+                }
 
-    float tlb = (float)(ctx->sample_pos + offset - note->sample_pos) /
-                cycle_len_lb + separation;
+                frame[nvl] = yl * (params.gain_left * envelope[i]);
+                frame[nvr] = yr * (params.gain_right * envelope[i]);
+            }
+        }
+    }
 
-    float tlt = (float)(ctx->sample_pos + offset - note->sample_pos) /
-                cycle_len_lt + separation;
+    if (params.filter) {
+        filter_bank_process(&note->filter, lanes, n);
+    }
 
-    float tr = (float)(ctx->sample_pos + offset - note->sample_pos) /
-               cycle_len_r - separation;
+    for (int i = 0; i < n; i ++) {
+        float *frame = lanes + i * WIDENING_OSCILLATORS;
+        float out_left = 0.0;
+        float out_right = 0.0;
+        for (int nv = 0; nv < WIDENING_OSCILLATORS / 2; nv ++) {
+            out_left += frame[nv * 2];
+            out_right += frame[nv * 2 + 1];
+        }
 
-    float trb = (float)(ctx->sample_pos + offset - note->sample_pos) /
-                cycle_len_rb - separation;
+        left[i] = out_left / 2.0;
+        right[i] = out_right / 2.0;
+    }
 
-    float trt = (float)(ctx->sample_pos + offset - note->sample_pos) /
-                cycle_len_rt - separation;
+    memcpy(note->oscillators, osc, sizeof(note->oscillators));
+    memcpy(note->ring_mod_oscillators, osc + WIDENING_OSCILLATORS,
+           sizeof(note->ring_mod_oscillators));
+    note->sync_oscillator = sync;
 
-    float xl = tl - floor(tl);
-    float xr = tr - floor(tr);
-    float xlb = tlb - floor(tlb);
-    float xrb = trb - floor(trb);
-    float xlt = tlt - floor(tlt);
-    float xrt = trt - floor(trt);
+    if (params.filter) {
+        filter_bank_flush_denormals(&note->filter);
+    }
 
-    // wave
-    float yl = wave(ctx, &frame->wave, note->track, nvl, xl);
-    float yr = wave(ctx, &frame->wave, note->track, nvr, xr);
-    float ylb = wave(ctx, &frame->wave, note->track, nvl, xlb);
-    float yrb = wave(ctx, &frame->wave, note->track, nvr, xrb);
-    float ylt = wave(ctx, &frame->wave, note->track, nvl, xlt);
-    float yrt = wave(ctx, &frame->wave, note->track, nvr, xrt);
+    // TODO FX
+}
 
-    float rma = frame->wave.ring_mod_amount;
-    yl = yl * (1 - rma) + (ylt * ylb / MAX_VALUE) * rma;
-    yr = yr * (1 - rma) + (yrt * yrb / MAX_VALUE) * rma;
+inline static float comp(float x, float threshold, float ratio) {
+    if (abs(x) > threshold) {
+        return threshold + (x - threshold) / ratio;
+    } else {
+        return x;
+    }
+}
 
-    // envelope
-    float e = envelope_gen_calculate(envelope, ctx->time);
+// Samples until the envelope leaves its current stage, -1 if it stays in it
+inline static int64_t envelope_stage_end(AudioContext *ctx,
+                                         EnvelopeGen *gen) {
+    float duration;
+    if (gen->state == ENVELOPE_ATTACK) {
+        duration = gen->attack;
+    } else if (gen->state == ENVELOPE_DECAY) {
+        duration = gen->decay;
+    } else if (gen->state == ENVELOPE_RELEASE) {
+        duration = gen->release;
+    } else {
+        return -1;
+    }
 
-    yl *= vol * e;
-    yr *= vol * e;
+    // stage changes on the first sample past its duration
+    return audio_context_samples_until(ctx, gen->start + ceil(duration));
+}
 
-    // panning
+// Returns number of samples starting from ctx->sample_pos which can be
+// rendered as one block, that is up to the next scheduled event,
+// frame end or envelope stage change
+static int audio_context_next_boundary(AudioContext *ctx, int max) {
+    int64_t n = max;
 
-    float pd = abs(pan - 0.5);
-    yl *= (1 - pan) * (-pd + 1) * 2;
-    yr *= pan * (-pd + 1) * 2;
+    NoteEvent *next = scheduler_peek(ctx->schedule);
+    if (next != NULL) {
+        n = MIN(n, audio_context_samples_until(ctx, next->time));
+    }
 
-    // filter
+    for (int i = 0; i < ctx->buffer->length; i ++) {
+        PlayingNote *note = ref_list_get(ctx->buffer, i);
+        n = MIN(n, get_frame_left(&note->frame, ctx->sample_pos));
 
-    if (frame->filter.cutoff < 0.995) {
-        filter_set_cutoff(note->filters[nvl], frame->filter.cutoff * 20000);
-        filter_set_resonance(note->filters[nvl], frame->filter.resonance);
+        int64_t envelope_end = envelope_stage_end(ctx, &note->envelope);
+        if (envelope_end > 0) {
+            n = MIN(n, envelope_end);
+        }
+    }
 
-        filter_set_cutoff(note->filters[nvr], frame->filter.cutoff * 20000);
-        filter_set_resonance(note->filters[nvr], frame->filter.resonance);
+    // boundaries at the current sample have been applied already
+    return MAX(n, 1);
+}
 
-        yl = filter_process(note->filters[nvl], yl / MAX_VALUE) * MAX_VALUE;
-        yr = filter_process(note->filters[nvr], yr / MAX_VALUE) * MAX_VALUE;
+// Gains of the audio track's bus, voices of a song track share
+// its volume and pan, solo track plays as is
+static MixerGains audio_context_track_gains(AudioContext *ctx, int bus) {
+    MixerGains gains = (MixerGains){ .left = 1.0, .right = 1.0 };
+    if (bus < MAX_TRACKS * MAX_PATTERN_VOICES) {
+        Song *song = ctx->state->song;
+        int song_track = bus / MAX_PATTERN_VOICES;
+        gains = mixer_gains(song->track_volumes[song_track],
+                            song->track_pans[song_track]);
     }
 
-    return (Output){ .left = yl, .right = yr };
+    gains.left *= MIXER_HEADROOM;
+    gains.right *= MIXER_HEADROOM;
+    return gains;
 }
 
-inline static Output instrument_voice(AudioContext *ctx, PlayingNote *note) {
+// Renders all notes of the track into its bus
+static void audio_context_render_track(AudioContext *ctx, int bus,
+                                       VoiceScratch *scratch) {
+    int n = ctx->block;
+    float *bus_left = ctx->bus_left[bus];
+    float *bus_right = ctx->bus_right[bus];
+    for (int k = 0; k < n; k ++) {
+        bus_left[k] = 0.0;
+        bus_right[k] = 0.0;
+    }
+
+    for (int j = 0; j < ctx->buffer->length; j ++) {
+        PlayingNote *note = ref_list_get(ctx->buffer, j);
+        if (note->track != bus) {
+            continue;
+        }
 
-    float rand_phase_offset = note->frame->wave.hard_sync == 0
-                              ? note->random * SAMPLE_RATE
-                              : 0;
-    Output first;
-    Output second;
-    if (note->frame->wave.ring_mod_amount == 0) {
-        first = single_voice(ctx, note, 0, 0, WIDENING_OFFSET / 2,
-                             rand_phase_offset + 1.0 / 12.);
-        second = single_voice(ctx, note, 1, WIDENING_DETUNE, WIDENING_OFFSET,
-                              rand_phase_offset);
-    } else {
-        first = ring_mod_voice(ctx, note, 0, 0, WIDENING_OFFSET / 2,
-                               rand_phase_offset + 1.0 / 12.);
-        second = ring_mod_voice(ctx, note, 1, WIDENING_DETUNE, WIDENING_OFFSET,
-                                rand_phase_offset);
+        instrument_voice_block(ctx, note, ctx->sample_pos, n, scratch);
+        for (int k = 0; k < n; k ++) {
+            bus_left[k] += scratch->left[k];
+            bus_right[k] += scratch->right[k];
+        }
     }
+}
 
-    EnvelopeGen *envelope = note->envelope;
-    if (envelope->state == ENVELOPE_IDLE) {
-        //audio_context_release_note(ctx, note);
+// Worker task, takes tracks of the block until there are none left.
+// Notes of a track never go to different threads, as they add up
+// in the bus of the track
+static void audio_context_render_tracks(void *arg, int worker) {
+    AudioContext *ctx = arg;
+    VoiceScratch *scratch = &ctx->scratch[worker];
+    if (worker != 0) {
+        cpu_flush_denormals(true); // the audio thread has done it already
     }
 
-    // TODO FX
-
-    return (Output) {
-        .left = (first.left + second.left) / 2.0,
-        .right = (first.right + second.right) / 2.0};
+    int i;
+    while ((i = atomic_fetch_add_explicit(&ctx->next_track, 1,
+                                          memory_order_relaxed)) <
+           ctx->track_count) {
+        audio_context_render_track(ctx, ctx->tracks[i], scratch);
+    }
 }
 
-const float clip_sin_threshold = 2.0 * MAX_VALUE / 3.;
+// Renders n samples of every track which has notes into its bus
+static void audio_context_render_buses(AudioContext *ctx, int n) {
+    bool used[AUDIO_TRACKS] = { false };
+    for (int j = 0; j < ctx->buffer->length; j ++) {
+        PlayingNote *note = ref_list_get(ctx->buffer, j);
+        used[note->track] = true;
+    }
 
-inline static float clip_sin(float x) {
-    if (abs(x) <= clip_sin_threshold) {
-        return sin(3 * PI * x / (4.0 * MAX_VALUE)) * MAX_VALUE;
-    } else {
-        return x < 0 ? -MAX_VALUE : MAX_VALUE;
+    ctx->track_count = 0;
+    for (int t = 0; t < AUDIO_TRACKS; t ++) {
+        if (used[t]) {
+            ctx->tracks[ctx->track_count] = t;
+            ctx->track_count += 1;
+        }
     }
-}
 
-inline static float comp(float x, float threshold, float ratio) {
-    if (abs(x) > threshold) {
-        return threshold + (x - threshold) / ratio;
+    ctx->block = n;
+    atomic_store_explicit(&ctx->next_track, 0, memory_order_relaxed);
+    if (ctx->workers != NULL && ctx->track_count > 1 &&
+        n >= AUDIO_PARALLEL_MIN_BLOCK) {
+        worker_pool_run(ctx->workers);
     } else {
-        return x;
+        audio_context_render_tracks(ctx, 0);
     }
 }
 
-void typed_audio_callback(AudioContext *ctx, short* stream, int len) {
+void typed_audio_callback(AudioContext *ctx, float *stream, int len) {
+    // decaying tails produce subnormals, which cost ~100 cycles each,
+    // flush mode belongs to the thread which happens to call back
+    cpu_flush_denormals(true);
 
-    float dt = 1.0 / SAMPLE_RATE;
+    // snapshots replaced before this point can't be taken anymore
+    snapshot_table_enter(ctx->snapshots);
 
-    for (int i = 0; i < len / 2; i ++) {
-        ctx->time += dt;
-        ctx->sample_pos += 1;
+    float *mix_left = ctx->mix_left;
+    float *mix_right = ctx->mix_right;
 
+    int i = 0;
+    while (i < len / 2) {
         audio_context_update_play_buffers(ctx);
 
-        float mix_left = 0.0;
-        float mix_right = 0.0;
-        for (int j = 0; j < ctx->buffer->length; j ++) {
-            PlayingNote *note = ref_list_get(ctx->buffer, j);
-            Output output = instrument_voice(ctx, note);
-            mix_left += output.left / 2.5; // - ~ 4db
-            mix_right += output.right / 2.5; // - ~ 4db
+        // render up to the next boundary, where the play buffers change
+        int n = audio_context_next_boundary(ctx, MIN(len / 2 - i,
+                                                     SAMPLE_BUFFER));
+
+        audio_context_render_buses(ctx, n);
+
+        mixer_clear(mix_left, n);
+        mixer_clear(mix_right, n);
+
+        // buses are complete here, the place for track effects
+        for (int j = 0; j < ctx->track_count; j ++) {
+            int bus = ctx->tracks[j];
+            MixerGains gains = audio_context_track_gains(ctx, bus);
+            mixer_add(mix_left, ctx->bus_left[bus], gains.left, n);
+            mixer_add(mix_right, ctx->bus_right[bus], gains.right, n);
+        }
+
+        mixer_output(mix_left, mix_right, stream + i * 2, n);
+
+        // idle notes are silent from now on
+        audio_context_reclaim_voices(ctx);
+
+        ctx->sample_pos += n;
+        i += n;
+    }
+
+    atomic_store_explicit(&ctx->clock, ctx->sample_pos, memory_order_release);
+}
+
+inline static bool note_listed(PlayingNote const *note, int const *ndx,
+                               int count) {
+    for (int i = 0; i < count; i ++) {
+        if (ndx[i] == note->ndx) {
+            return true;
         }
+    }
+    return false;
+}
+
+// Plays the context up to pos without output. Notes listed by their ndx
+// are rendered on the way, so they get there in the same state
+// a render would leave them in, others only have their envelopes stepped
+static void audio_context_skip(AudioContext *ctx, uint64_t pos,
+                               int const *rendered, int count) {
+    cpu_flush_denormals(true);
+    snapshot_table_enter(ctx->snapshots);
 
-        mix_left = clip_sin(mix_left);
-        mix_right = clip_sin(mix_right);
+    VoiceScratch *scratch = &ctx->scratch[0];
+    while (ctx->sample_pos < pos) {
+        audio_context_update_play_buffers(ctx);
+        int n = audio_context_next_boundary(ctx, MIN(pos - ctx->sample_pos,
+                                                     SAMPLE_BUFFER));
+
+        for (int i = 0; i < ctx->buffer->length; i ++) {
+            PlayingNote *note = ref_list_get(ctx->buffer, i);
+            if (note_listed(note, rendered, count)) {
+                instrument_voice_block(ctx, note, ctx->sample_pos, n,
+                                       scratch);
+            } else {
+                // where a render would have calculated it last
+                envelope_gen_advance(&note->envelope,
+                                     ctx->sample_pos + n - 1);
+            }
+        }
 
-        stream[i * 2] = floor(mix_left);
-        stream[i * 2 + 1] = floor(mix_right);
+        audio_context_reclaim_voices(ctx);
+        ctx->sample_pos += n;
     }
 
-    if (ctx->time > 6) {
-        audio_context_offset_time(ctx, 6);
+    atomic_store_explicit(&ctx->clock, ctx->sample_pos, memory_order_release);
+}
+
+void audio_context_seek_offline(AudioContext *ctx, int bar, uint64_t pos) {
+    // song starts on a whole sample, as the export of the first bar does
+    uint64_t start = llround(sequencer_bar_pos(ctx->sequencer, bar));
+    int ndx = ctx->note_ndx;
+
+    // first pass finds the notes which still sound at pos
+    audio_context_play_offline(ctx, bar, start);
+    audio_context_skip(ctx, pos, NULL, 0);
+
+    int sounding[VOICE_POOL_SIZE];
+    int count = ctx->buffer->length;
+    for (int i = 0; i < count; i ++) {
+        PlayingNote *note = ref_list_get(ctx->buffer, i);
+        sounding[i] = note->ndx;
     }
+
+    // second one gets the same events, so it numbers notes the same
+    audio_context_drop_song_notes(ctx);
+    ctx->note_ndx = ndx;
+    audio_context_play_offline(ctx, bar, start);
+    audio_context_skip(ctx, pos, sounding, count);
 }
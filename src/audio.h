@@ -4,27 +4,47 @@
 #include "state.h" // State
 #include "reflist.h" // RefList
 #include "util.h" // MAX, MIN
-#include "filter.h" // LadderFilter
+#include "filter.h" // FilterBank
+#include "pitch.h" // pitch_freq
+#include "wavetable.h" // WaveTableForm, WAVETABLE_BANK_LANES
+#include "event_queue.h" // EventQueue
+#include "scheduler.h" // Scheduler
+#include "sequencer.h" // Sequencer
+#include "workers.h" // WorkerPool
+#include "mixer.h" // mixer_add
+#include "cpu.h" // cpu_flush_denormals
+#include "snapshot.h" // InstrumentSnapshot
 #include <SDL2/SDL.h>
 #include <math.h> // floor
 #include <string.h> // memcpy
 #include <stdbool.h> // bool
-#include <pthread.h> // pthread_mutex_
+#include <stdint.h> // uint64_t
+#include <stdatomic.h> // atomic_uint_least64_t
+#include <unistd.h> // sysconf
 
-#define SAMPLE_BUFFER 1024
-#define SAMPLE_RATE 44100
+#define SAMPLE_BUFFER 1024 // largest block rendered at once, default buffer
+#define SAMPLE_RATE 44100 // default, contexts run at their own sample_rate
+#define MIN_SAMPLE_RATE 22050
+#define MAX_SAMPLE_RATE 192000
+#define MIN_DEVICE_BUFFER 32
+#define MAX_DEVICE_BUFFER 8192
 #define ENVELOPE_CURVE 3
-#define ENVELOPE_MIN_ATTACK 0.002
-#define ENVELOPE_MAX_ATTACK 8
-#define ENVELOPE_MIN_DECAY 0.006
-#define ENVELOPE_MAX_DECAY 12
-#define ENVELOPE_MIN_RELEASE 0.006
-#define ENVELOPE_MAX_RELEASE 24
-#define MAX_VALUE 32767
+#define MAX_VALUE 32767 // samples are in -1..1, forms are combined as int16
 #define WIDENING_DETUNE 0.24
 #define WIDENING_OFFSET -0.4
 #define WIDENING_OSCILLATORS 4
-#define TETT 1.0594630943592953  // 2 ^ (1 / 12)
+#define VOICE_POOL_SIZE 256
+#define EVENT_QUEUE_SIZE 1024
+#define MAX_SCHEDULED_EVENTS 4096
+#define SCHEDULE_RELEASE_RESERVE 256 // slots note-ons leave for releases
+#define AUDIO_TRACKS (MAX_TRACKS * MAX_PATTERN_VOICES + 1) // 8 * 2 + solo
+#define AUDIO_MAX_THREADS 8 // rendering tracks, the audio thread included
+#define AUDIO_PARALLEL_MIN_BLOCK 64 // shorter blocks aren't worth waking for
+
+_Static_assert(WIDENING_OSCILLATORS == FILTER_BANK_LANES,
+               "Oscillators of a voice are filtered by one bank");
+_Static_assert(WIDENING_OSCILLATORS == WAVETABLE_BANK_LANES,
+               "Oscillators of a voice are read by one wavetable bank");
 
 typedef enum {
     ENVELOPE_IDLE = 0,
@@ -34,14 +54,15 @@ typedef enum {
     ENVELOPE_RELEASE,
 } EnvelopeState;
 
+// stage durations, start and last are in samples
 typedef struct {
     float attack;
     float decay;
     float sustain;
     float release;
     EnvelopeState state;
-    float start;
-    float last;
+    uint64_t start;
+    uint64_t last;
     float value;
     bool released;
 } EnvelopeGen;
@@ -53,28 +74,7 @@ typedef enum {
 } NoteState;
 
 typedef struct {
-    int sample_pos;
-    int duration;
-
-    int step_n;
-    char form;
-    float ring_mod; // 1 - 256
-    float ring_mod_amount; // 1 - 256
-    float hard_sync; // 1 - 256
-    float pulse_width; // 1 - 256
-} WaveFrame;
-
-typedef struct {
-    int sample_pos;
-    int duration;
-
-    int step_n;
-    float resonance;
-    float cutoff;
-} FilterFrame;
-
-typedef struct {
-    int sample_pos;
+    uint64_t sample_pos;
     int duration;
 
     int step_n;
@@ -91,6 +91,13 @@ typedef struct {
     };
 } Frame;
 
+typedef struct {
+    float phase; // 0 - 1
+    float increment;
+    float origin; // phase at the start of the note
+    int level; // wavetable level
+} Oscillator;
+
 typedef struct {
     int instrument;
     int track;
@@ -98,59 +105,156 @@ typedef struct {
     int note;
     int ndx;
     bool song_note;
-    float time;
+    uint64_t time;
     NoteState state;
-    EnvelopeGen *envelope;
-    Frame *frame;
-    Instrument *instrument_ref;
-    Arpeggio *arpeggio_ref;
+    EnvelopeGen envelope;
+    Frame frame;
+    bool has_frame;
+    InstrumentSnapshot *instrument_ref; // taken again at every block start
+    ArpeggioSnapshot *arpeggio_ref;
     float random;
-    int sample_pos;
-    LadderFilter *filters[WIDENING_OSCILLATORS];
+    unsigned int noize_seed;
+    float noize_values[WIDENING_OSCILLATORS * 2]; // value, last phase
+    uint64_t sample_pos;
+    FilterBank filter; // a lane per oscillator
+    Oscillator oscillators[WIDENING_OSCILLATORS];
+    Oscillator ring_mod_oscillators[WIDENING_OSCILLATORS];
+    Oscillator sync_oscillator;
+    bool oscillators_ready;
+    float oscillators_pitch;
+    float oscillators_hard_sync;
+    float oscillators_ring_mod;
+    bool oscillators_ring_mod_on;
 } PlayingNote;
 
-// queue  - queue with future note trigger and release events
-//          updates on song start, and on keyboard presses
-//          updates are pushed from play function
+// Fixed set of notes reserved up front, so the audio callback
+// never goes to the heap. Used only by the audio thread
+typedef struct {
+    int cap;
+    int free_count;
+    PlayingNote *notes;
+    PlayingNote **free_notes;
+} VoicePool;
+
+// events - lock-free queue of note trigger and release events
+//          pushed by the UI thread on keyboard presses
+//
+// schedule - time ordered future events, owned by the audio thread,
+//          filled from the events queue and by the sequencer
+//
+// sequencer - walks the song on the audio thread keeping the schedule
+//          filled up to a bar ahead of the playback
+//
+// snapshots - compiled instruments and arpeggios, published by the UI
+//          thread on edits, notes take the current ones at block starts
 //
 // buffer - play buffer, contains notes which are currently playing
 //          updates when notes are pressed or playing in the pattern
 //          (up to ~ 34 Gz)
-//          updates are pulled from the audio_callback
-//          clears after notes envelopes go idle
+//          updates are applied by the audio_callback at block
+//          boundaries: events, frame ends and envelope stage changes
+//          notes are returned to the pool at the end of the block
+//          in which their envelope went idle
+//
+// ui -(event)-> events -> schedule -> buffer => ~~~-> samples
+//                     sequencer -^
+//
+// buffer notes are rendered track by track into the bus buffers,
+// either by the audio thread alone or together with the workers,
+// then the audio thread applies track gains and sums the buses
+// into the master bus, which is soft clipped to the output
 //
-// ui/song -(note|event)-> queue -> buffer => ~~~-> samples
+// Per thread buffers of the voice rendering
+typedef struct {
+    float envelope[SAMPLE_BUFFER];
+    float lanes[SAMPLE_BUFFER * WIDENING_OSCILLATORS]; // interleaved
+    float ring_mod[SAMPLE_BUFFER * WIDENING_OSCILLATORS]; // interleaved too
+    float left[SAMPLE_BUFFER];
+    float right[SAMPLE_BUFFER];
+} VoiceScratch;
+
 typedef struct {
     State *state;
     RefList *buffer;
-    RefList *queue;
-    float noize_values
-        [MAX_TRACKS * MAX_PATTERN_VOICES + 1] // 8 * 2 + solo
-        [WIDENING_OSCILLATORS * 2];
-    SDL_AudioSpec spec;
-    int sample_pos;
-    float time;
+    EventQueue *events;
+    Scheduler *schedule;
+    Sequencer *sequencer;
+    SnapshotTable *snapshots;
+    VoicePool *pool;
+    SDL_AudioSpec spec; // obtained from the device
+    int sample_rate; // every duration is derived from it
+    uint64_t sample_pos; // position of the next sample, the only timebase
+    atomic_uint_least64_t clock; // sample_pos published for the UI thread
     int start_bar;
-    float start_time;
+    uint64_t start_pos;
     volatile bool playing;
-    volatile int update_buffer_at;
-    volatile int update_frames_at;
-    pthread_mutex_t update_request_mutex;
-    pthread_mutex_t queue_mutex;
     volatile int frames_update_count;
     volatile int buffer_update_count;
+    volatile int active_voices; // notes in the buffer after the last block
+    atomic_int dropped_notes; // note-ons dropped for a full schedule, for UI
+    SDL_AudioDeviceID device; // 0 when rendering offline
     int note_ndx;
+    WorkerPool *workers; // NULL when tracks are rendered serially
+    int tracks[AUDIO_TRACKS]; // tracks with notes in the current block
+    int track_count;
+    atomic_int next_track; // next one to take by a rendering thread
+    int block; // samples in the current block
+    VoiceScratch scratch[AUDIO_MAX_THREADS];
+    float bus_left[AUDIO_TRACKS][SAMPLE_BUFFER];
+    float bus_right[AUDIO_TRACKS][SAMPLE_BUFFER];
+    FilterTable filter_table; // at the context rate
+    float mix_left[SAMPLE_BUFFER];
+    float mix_right[SAMPLE_BUFFER];
 } AudioContext;
 
-AudioContext *audio_context_init(State *state);
+// opens the audio device with buffer frames long buffers,
+// device may choose another rate and buffer, the obtained ones are used
+AudioContext *audio_context_init(State *state, int sample_rate, int buffer);
+
+// context without a device, rendered by calling typed_audio_callback
+AudioContext *audio_context_init_offline(State *state, int sample_rate);
+
+// renders len / 2 stereo frames to the stream
+void typed_audio_callback(AudioContext *ctx, float *stream, int len);
+
+// renders tracks on threads threads, the audio thread included,
+// up to AUDIO_MAX_THREADS; has to be called before the playback
+bool audio_context_start_workers(AudioContext *ctx, int threads);
 
 void audio_context_play(AudioContext *ctx, int start_bar);
 
+// starts the song right away with the clock moved to pos, without
+// going through the events queue; only for contexts without a device
+void audio_context_play_offline(AudioContext *ctx, int start_bar,
+                                double pos);
+
+// starts the song at the first sample of bar like play_offline and
+// brings the context to pos without mixing the song before it. Notes
+// still sounding at pos are rendered from where the context starts them,
+// so those triggered from bar on go on exactly as in a render from bar,
+// the chased ones as in a render which chased them at bar. Plays the bars
+// before pos twice, only for contexts without a device
+void audio_context_seek_offline(AudioContext *ctx, int bar, uint64_t pos);
+
 bool audio_context_trigger_step(AudioContext *ctx, int instrument, int arpeggio,
                            int note, int step, int step_div);
 
 void audio_context_stop(AudioContext *ctx);
 
+// song edits have to be reported for the playback to pick them up,
+// bar -1 stands for the whole song. The interface reports them
+// from the handlers of its song and pattern controls
+void audio_context_invalidate_bar(AudioContext *ctx, int bar);
+
+void audio_context_invalidate_pattern(AudioContext *ctx, int pattern);
+
+// instrument and arpeggio edits have to be published for the playback
+// to pick them up, tempo changes too, n -1 stands for all of them.
+// The interface republishes them all from the handler of its bpm control
+bool audio_context_update_instrument(AudioContext *ctx, int n);
+
+bool audio_context_update_arpeggio(AudioContext *ctx, int n);
+
 void audio_context_free(AudioContext *ctx);
 
 #endif // AUDIO_H
@@ -0,0 +1,364 @@
+#include "bench.h"
+
+typedef struct {
+    char const *name;
+    void (*run)(void);
+} Bench;
+
+// keeps results alive so calculations are not optimized out
+volatile float bench_sink;
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_report(char const *bench, char const *name, double elapsed,
+                         long calls, int calls_per_sample) {
+    double ns = elapsed / calls * 1e9;
+
+    // cost of one second of a voice if calculated on every sample
+    double voice_ms = ns * calls_per_sample * SAMPLE_RATE / 1e6;
+    printf("%s: %-8s %8.2f ns/call %8.3f ms per voice second\n",
+           bench, name, ns, voice_ms);
+}
+
+// Before phase accumulators a ring modulated voice with hard sync
+// calculated frequency 6 times per sample
+static void bench_pitch(void) {
+    const int calls_per_sample = 6;
+    const int n = 4096;
+    float notes[4096];
+    unsigned int seed = 1;
+    for (int i = 0; i < n; i ++) {
+        seed = seed * 1103515245 + 12345;
+        notes[i] = (float)((seed >> 16) % (3 * MAX_NOTE * 4)) / 4;
+    }
+
+    pitch_table_init();
+
+    float sum = 0;
+    double start = bench_now();
+    for (long i = 0; i < BENCH_ITERATIONS; i ++) {
+        sum += pitch_freq_pow(notes[i & (n - 1)]);
+    }
+    bench_report("pitch", "pow", bench_now() - start, BENCH_ITERATIONS,
+                 calls_per_sample);
+
+    start = bench_now();
+    for (long i = 0; i < BENCH_ITERATIONS; i ++) {
+        sum += pitch_freq(notes[i & (n - 1)]);
+    }
+    bench_report("pitch", "table", bench_now() - start, BENCH_ITERATIONS,
+                 calls_per_sample);
+
+    float error = 0;
+    for (int i = 0; i < 3 * MAX_NOTE * 100; i ++) {
+        float note = (float)i / 100;
+        float exact = pitch_freq_pow(note);
+        error = MAX(error, fabs(pitch_freq(note) - exact) / exact);
+    }
+    printf("pitch: max relative error %e\n", error);
+
+    bench_sink = sum;
+}
+
+// Filter banks ring once after an impulse and get nothing but silence
+// after that, as they do in release tails. Reports cost of a sample
+// of a lane in the first and the last window of the tail
+static void bench_filter_tail(char const *name, FilterTable const *table,
+                              bool ftz, bool guard) {
+    const int banks = BENCH_TAIL_FILTERS / FILTER_BANK_LANES;
+    const int windows = 8;
+    const int window_blocks = SAMPLE_RATE / SAMPLE_BUFFER / 4; // ~ 0.25 s
+    static float lanes[SAMPLE_BUFFER * FILTER_BANK_LANES];
+    FilterBank tail[BENCH_TAIL_FILTERS / FILTER_BANK_LANES];
+    for (int i = 0; i < banks; i ++) {
+        filter_bank_reset(&tail[i]);
+        filter_bank_set(&tail[i], table,
+                        (500 + i * 400) / FILTER_MAX_CUTOFF, 0.3);
+    }
+
+    cpu_flush_denormals(ftz);
+
+    float sum = 0;
+    double first = 0;
+    double last = 0;
+    for (int w = 0; w < windows; w ++) {
+        double start = bench_now();
+        for (int b = 0; b < window_blocks; b ++) {
+            for (int i = 0; i < banks; i ++) {
+                bool impulse = w == 0 && b == 0;
+                for (int j = 0; j < SAMPLE_BUFFER * FILTER_BANK_LANES; j ++) {
+                    lanes[j] = impulse && j < FILTER_BANK_LANES ? 1.0 : 0.0;
+                }
+
+                filter_bank_process(&tail[i], lanes, SAMPLE_BUFFER);
+                sum += lanes[SAMPLE_BUFFER * FILTER_BANK_LANES - 1];
+
+                if (guard) {
+                    filter_bank_flush_denormals(&tail[i]);
+                }
+            }
+        }
+
+        double ns = (bench_now() - start) /
+                    ((double)window_blocks * SAMPLE_BUFFER *
+                     BENCH_TAIL_FILTERS) * 1e9;
+        first = w == 0 ? ns : first;
+        last = ns;
+    }
+
+    cpu_flush_denormals(false);
+    printf("denormal: %-8s %8.2f ns/sample ringing %8.2f ns/sample "
+           "in the tail\n", name, first, last);
+
+    bench_sink = sum;
+}
+
+// Without any protection subnormal state never decays to zero
+// and keeps every sample of a silent voice slow
+static void bench_denormal(void) {
+    static FilterTable table;
+    filter_table_init(&table, SAMPLE_RATE);
+
+    bench_filter_tail("plain", &table, false, false);
+    bench_filter_tail("guard", &table, false, true);
+    bench_filter_tail("ftz", &table, true, false);
+    bench_filter_tail("both", &table, true, true);
+}
+
+// Cost of a sample of a filtered voice, with coefficients updated
+// on every sample or once a block, calculated or looked up
+static void bench_filter_voice(char const *name, FilterTable const *table,
+                               float const *cutoffs, float const *resonances,
+                               int n, bool per_sample) {
+    const int blocks = 200;
+    static float lanes[SAMPLE_BUFFER * FILTER_BANK_LANES];
+    FilterBank bank;
+    filter_bank_reset(&bank);
+
+    float sum = 0;
+    unsigned int seed = 1;
+    double start = bench_now();
+    for (int b = 0; b < blocks; b ++) {
+        for (int j = 0; j < SAMPLE_BUFFER; j ++) {
+            seed = seed * 1103515245 + 12345;
+            float x = (float)(seed >> 16) / 32768 - 1;
+            for (int i = 0; i < FILTER_BANK_LANES; i ++) {
+                lanes[j * FILTER_BANK_LANES + i] = x;
+            }
+        }
+
+        // a sample at a time when the coefficients change on every one
+        int step = per_sample ? 1 : SAMPLE_BUFFER;
+        for (int j = 0; j < SAMPLE_BUFFER; j += step) {
+            int c = (per_sample ? b * SAMPLE_BUFFER + j : b) & (n - 1);
+            if (table != NULL) {
+                filter_bank_set(&bank, table, cutoffs[c], resonances[c]);
+            } else {
+                FilterCoefficients coefficients;
+                filter_coefficients(&coefficients,
+                                    cutoffs[c] * FILTER_MAX_CUTOFF,
+                                    SAMPLE_RATE);
+                filter_bank_set_coefficients(&bank, &coefficients,
+                                             resonances[c]);
+            }
+            filter_bank_process(&bank, lanes + j * FILTER_BANK_LANES, step);
+        }
+
+        for (int j = 0; j < SAMPLE_BUFFER * FILTER_BANK_LANES; j ++) {
+            sum += lanes[j];
+        }
+        filter_bank_flush_denormals(&bank);
+    }
+
+    double ns = (bench_now() - start) / ((double)blocks * SAMPLE_BUFFER) * 1e9;
+    printf("filter: voice %-14s %8.2f ns/sample\n", name, ns);
+
+    bench_sink = sum;
+}
+
+// Before coefficient tables the cutoff was set with a sin call
+// whenever it moved, while the resonance was only applied with it
+static void bench_filter(void) {
+    // the oscillators of a voice share the coefficients of their bank
+    const int calls_per_sample = WIDENING_OSCILLATORS / FILTER_BANK_LANES;
+    const int n = 4096;
+    float cutoffs[4096];
+    float resonances[4096];
+    unsigned int seed = 1;
+    for (int i = 0; i < n; i ++) {
+        seed = seed * 1103515245 + 12345;
+        cutoffs[i] = (float)((seed >> 16) % FILTER_TABLE_STEPS) /
+                     FILTER_TABLE_STEPS;
+        seed = seed * 1103515245 + 12345;
+        resonances[i] = (float)((seed >> 16) % FILTER_TABLE_STEPS) /
+                        FILTER_TABLE_STEPS;
+    }
+
+    static FilterTable table;
+    filter_table_init(&table, SAMPLE_RATE);
+
+    FilterBank bank;
+    filter_bank_reset(&bank);
+
+    const long iterations = BENCH_ITERATIONS / 10;
+    float sum = 0;
+    double start = bench_now();
+    for (long i = 0; i < iterations; i ++) {
+        FilterCoefficients coefficients;
+        filter_coefficients(&coefficients,
+                            cutoffs[i & (n - 1)] * FILTER_MAX_CUTOFF,
+                            SAMPLE_RATE);
+        filter_bank_set_coefficients(&bank, &coefficients,
+                                     resonances[i & (n - 1)]);
+        sum += bank.feedback;
+    }
+    bench_report("filter", "compute", bench_now() - start, iterations,
+                 calls_per_sample);
+
+    start = bench_now();
+    for (long i = 0; i < iterations; i ++) {
+        filter_bank_set(&bank, &table, cutoffs[i & (n - 1)],
+                        resonances[i & (n - 1)]);
+        sum += bank.feedback;
+    }
+    bench_report("filter", "table", bench_now() - start, iterations,
+                 calls_per_sample);
+
+    bench_sink = sum;
+
+    bench_filter_voice("compute/sample", NULL, cutoffs, resonances, n, true);
+    bench_filter_voice("table/sample", &table, cutoffs, resonances, n, true);
+    bench_filter_voice("compute/block", NULL, cutoffs, resonances, n, false);
+    bench_filter_voice("table/block", &table, cutoffs, resonances, n, false);
+}
+
+static double bench_kernel_ns(double start, int blocks) {
+    return (bench_now() - start) / ((double)blocks * SAMPLE_BUFFER) * 1e9;
+}
+
+// Cost of a frame of the mixer, filter bank and wavetable bank kernels
+// of every set the CPU runs
+static void bench_kernels(void) {
+    const int blocks = 20000;
+    static float left[SAMPLE_BUFFER];
+    static float right[SAMPLE_BUFFER];
+    static float stream[SAMPLE_BUFFER * 2];
+    static short out[SAMPLE_BUFFER * 2];
+    static float input[SAMPLE_BUFFER * FILTER_BANK_LANES];
+    static float lanes[SAMPLE_BUFFER * FILTER_BANK_LANES];
+    unsigned int seed = 1;
+    for (int i = 0; i < SAMPLE_BUFFER * FILTER_BANK_LANES; i ++) {
+        seed = seed * 1103515245 + 12345;
+        input[i] = (float)(seed >> 16) / 32768 - 1;
+    }
+
+    static FilterTable table;
+    filter_table_init(&table, SAMPLE_RATE);
+    wavetable_init();
+
+    for (int k = 0; k < CPU_KERNELS_COUNT; k ++) {
+        if (!cpu_kernels_supported(k)) {
+            continue;
+        }
+
+        char const *name = cpu_kernels_name(k);
+        MixerKernels const *mixer = mixer_kernels(k);
+        FilterBankKernel bank_process = filter_bank_kernel(k);
+        memcpy(left, input, sizeof(left));
+        memcpy(right, input + SAMPLE_BUFFER, sizeof(right));
+
+        double start = bench_now();
+        for (int b = 0; b < blocks; b ++) {
+            mixer->add(left, right, 1e-4, SAMPLE_BUFFER);
+        }
+        printf("kernels: %-6s %-8s %8.2f ns/frame\n", name, "add",
+               bench_kernel_ns(start, blocks));
+
+        start = bench_now();
+        for (int b = 0; b < blocks; b ++) {
+            mixer->output(left, right, stream, SAMPLE_BUFFER);
+        }
+        printf("kernels: %-6s %-8s %8.2f ns/frame\n", name, "output",
+               bench_kernel_ns(start, blocks));
+
+        start = bench_now();
+        for (int b = 0; b < blocks; b ++) {
+            mixer->to_s16(stream, out, SAMPLE_BUFFER * 2);
+        }
+        printf("kernels: %-6s %-8s %8.2f ns/frame\n", name, "to_s16",
+               bench_kernel_ns(start, blocks));
+
+        FilterBank bank;
+        filter_bank_reset(&bank);
+        filter_bank_set(&bank, &table, 0.3, 0.9);
+        start = bench_now();
+        for (int b = 0; b < blocks; b ++) {
+            memcpy(lanes, input, sizeof(lanes));
+            bank_process(&bank, lanes, SAMPLE_BUFFER);
+            filter_bank_flush_denormals(&bank);
+        }
+        printf("kernels: %-6s %-8s %8.2f ns/frame\n", name, "bank",
+               bench_kernel_ns(start, blocks));
+
+        // a voice of detuned saws, each at its own level
+        WavetableBankKernel read = wavetable_bank_kernel(k);
+        float const *saws[WAVETABLE_BANK_LANES];
+        float phases[WAVETABLE_BANK_LANES];
+        float increments[WAVETABLE_BANK_LANES];
+        for (int l = 0; l < WAVETABLE_BANK_LANES; l ++) {
+            increments[l] = 0.002 * (l + 1);
+            phases[l] = 0;
+            saws[l] = wavetable_get(WAVETABLE_SAW,
+                                    wavetable_level(increments[l]));
+        }
+        start = bench_now();
+        for (int b = 0; b < blocks; b ++) {
+            read(phases, increments, saws, lanes, SAMPLE_BUFFER);
+        }
+        printf("kernels: %-6s %-8s %8.2f ns/frame\n", name, "tables",
+               bench_kernel_ns(start, blocks));
+
+        bench_sink = stream[0] + out[0] + lanes[0];
+    }
+}
+
+static const Bench benches[] = {
+    { .name = "pitch", .run = bench_pitch },
+    { .name = "denormal", .run = bench_denormal },
+    { .name = "filter", .run = bench_filter },
+    { .name = "kernels", .run = bench_kernels },
+};
+
+int bench_run(int argc, char *argv[]) {
+    int count = sizeof(benches) / sizeof(Bench);
+    int status = 0;
+    printf("kernels: %s in use\n", cpu_kernels_name(kernels_current()));
+
+    if (argc == 0) {
+        for (int i = 0; i < count; i ++) {
+            benches[i].run();
+        }
+        return status;
+    }
+
+    for (int i = 0; i < argc; i ++) {
+        bool found = false;
+        for (int j = 0; j < count; j ++) {
+            if (strcmp(argv[i], benches[j].name) == 0) {
+                benches[j].run();
+                found = true;
+            }
+        }
+
+        if (!found) {
+            fprintf(stderr, "Unknown benchmark: %s\n", argv[i]);
+            status = 1;
+        }
+    }
+
+    return status;
+}
@@ -0,0 +1,22 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "pitch.h" // pitch_freq
+#include "audio.h" // SAMPLE_RATE
+#include "filter.h" // FilterBank
+#include "cpu.h" // cpu_flush_denormals
+#include "kernels.h" // kernels_current
+#include "mixer.h" // mixer_kernels
+#include "wavetable.h" // wavetable_bank_kernel
+#include <stdio.h> // printf
+#include <string.h> // strcmp
+#include <time.h> // clock_gettime
+
+#define BENCH_ITERATIONS 10000000
+#define BENCH_TAIL_FILTERS 16 // filters of 4 voices, a bank each
+
+// runs benchmarks listed in argv or all of them if there are none,
+// returns process exit code
+int bench_run(int argc, char *argv[]);
+
+#endif // BENCH_H
@@ -0,0 +1,85 @@
+#include "cpu.h"
+
+#define CPU_MXCSR_DAZ (1 << 6)
+#define CPU_MXCSR_FTZ (1 << 15)
+#define CPU_FPCR_FZ (1 << 24)
+
+void cpu_flush_denormals(bool on) {
+#if defined(__SSE__)
+    unsigned int flags = CPU_MXCSR_DAZ | CPU_MXCSR_FTZ;
+    unsigned int csr = _mm_getcsr();
+    _mm_setcsr(on ? csr | flags : csr & ~flags);
+#elif defined(__aarch64__)
+    uint64_t fpcr;
+    __asm__ volatile("mrs %0, fpcr" : "=r"(fpcr));
+    fpcr = on ? fpcr | CPU_FPCR_FZ : fpcr & ~(uint64_t)CPU_FPCR_FZ;
+    __asm__ volatile("msr fpcr, %0" : : "r"(fpcr));
+#else
+    (void)on;
+#endif
+}
+
+#ifdef CPU_X86
+#define CPU_XCR0_AVX 0x6 // XMM and YMM state
+
+// extended control register 0, enabled state components
+static uint64_t cpu_xcr0(void) {
+    uint32_t eax;
+    uint32_t edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((uint64_t)edx << 32) | eax;
+}
+#endif
+
+unsigned int cpu_features(void) {
+    unsigned int features = 0;
+#ifdef CPU_X86
+    unsigned int eax;
+    unsigned int ebx;
+    unsigned int ecx;
+    unsigned int edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return features;
+    }
+
+    if (edx & bit_SSE2) {
+        features |= CPU_FEATURE_SSE2;
+    }
+
+    // AVX instructions fault if the OS doesn't save YMM registers
+    bool avx = (ecx & bit_OSXSAVE) && (ecx & bit_AVX) &&
+               (cpu_xcr0() & CPU_XCR0_AVX) == CPU_XCR0_AVX;
+    if (avx && __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) &&
+        (ebx & bit_AVX2)) {
+        features |= CPU_FEATURE_AVX2;
+    }
+#endif
+    return features;
+}
+
+bool cpu_kernels_supported(CpuKernels kernels) {
+    if (kernels == CPU_KERNELS_SCALAR) {
+        return true;
+    }
+#ifdef CPU_X86
+    unsigned int features = cpu_features();
+    if (kernels == CPU_KERNELS_SSE2) {
+        return features & CPU_FEATURE_SSE2;
+    }
+    if (kernels == CPU_KERNELS_AVX2) {
+        return (features & CPU_FEATURE_SSE2) && (features & CPU_FEATURE_AVX2);
+    }
+#endif
+    return false;
+}
+
+char const *cpu_kernels_name(CpuKernels kernels) {
+    static char const *names[CPU_KERNELS_COUNT] = {
+        [CPU_KERNELS_SCALAR] = "scalar",
+        [CPU_KERNELS_SSE2] = "sse2",
+        [CPU_KERNELS_AVX2] = "avx2"};
+    if (kernels < 0 || kernels >= CPU_KERNELS_COUNT) {
+        return "unknown";
+    }
+    return names[kernels];
+}
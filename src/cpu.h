@@ -0,0 +1,51 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdbool.h> // bool
+#include <stdint.h> // uint64_t
+#ifdef __SSE__
+#include <xmmintrin.h> // _mm_getcsr
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h> // __get_cpuid
+#define CPU_X86
+// functions using instructions beyond the ones the binary is built for,
+// only called once the CPU is known to have them
+#define CPU_TARGET_SSE2 __attribute__((target("sse2")))
+#define CPU_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+typedef enum {
+    CPU_FEATURE_SSE2 = 1 << 0,
+    CPU_FEATURE_AVX2 = 1 << 1, // the OS saves AVX registers as well
+} CpuFeature;
+
+// Instruction sets DSP kernels are built for, from the slowest one
+typedef enum {
+    CPU_KERNELS_SCALAR,
+    CPU_KERNELS_SSE2,
+    CPU_KERNELS_AVX2,
+    CPU_KERNELS_COUNT,
+} CpuKernels;
+
+// set every CPU the binary runs on has
+#ifdef __SSE2__
+#define CPU_KERNELS_BASELINE CPU_KERNELS_SSE2
+#else
+#define CPU_KERNELS_BASELINE CPU_KERNELS_SCALAR
+#endif
+
+// Makes float operations of the calling thread treat subnormal inputs
+// and results as zero (FTZ and DAZ on x86, FZ on arm64),
+// does nothing on other platforms. The mode is kept per thread
+void cpu_flush_denormals(bool on);
+
+// CpuFeature flags of the running CPU, read with cpuid, 0 if not on x86
+unsigned int cpu_features(void);
+
+// true if kernels of the set are built in and the CPU runs them
+bool cpu_kernels_supported(CpuKernels kernels);
+
+char const *cpu_kernels_name(CpuKernels kernels);
+
+#endif // CPU_H
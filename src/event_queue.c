@@ -0,0 +1,63 @@
+#include "event_queue.h"
+
+EventQueue *event_queue_init(unsigned int cap) {
+    unsigned int size = 1;
+    while (size < cap) {
+        size <<= 1;
+    }
+
+    NoteEvent *events = malloc(sizeof(NoteEvent) * size);
+    if (events == NULL) {
+        return NULL;
+    }
+
+    EventQueue *queue = malloc(sizeof(EventQueue));
+    if (queue == NULL) {
+        free(events);
+        return NULL;
+    }
+
+    queue->cap = size;
+    queue->events = events;
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+
+    return queue;
+}
+
+bool event_queue_push(EventQueue *queue, NoteEvent const *events, int n) {
+    unsigned int tail = atomic_load_explicit(&queue->tail,
+                                             memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&queue->head,
+                                             memory_order_acquire);
+    if (queue->cap - (tail - head) < (unsigned int)n) {
+        return false;
+    }
+
+    for (int i = 0; i < n; i ++) {
+        queue->events[(tail + i) & (queue->cap - 1)] = events[i];
+    }
+
+    // publish all of them at once
+    atomic_store_explicit(&queue->tail, tail + n, memory_order_release);
+    return true;
+}
+
+bool event_queue_pop(EventQueue *queue, NoteEvent *event) {
+    unsigned int head = atomic_load_explicit(&queue->head,
+                                             memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&queue->tail,
+                                             memory_order_acquire);
+    if (head == tail) {
+        return false;
+    }
+
+    *event = queue->events[head & (queue->cap - 1)];
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return true;
+}
+
+void event_queue_free(EventQueue *queue) {
+    free(queue->events);
+    free(queue);
+}
@@ -0,0 +1,48 @@
+#ifndef EVENT_QUEUE_H
+#define EVENT_QUEUE_H
+
+#include <stdatomic.h> // atomic_uint
+#include <stdbool.h> // bool
+#include <stdint.h> // uint64_t
+#include <stdlib.h>  // malloc
+
+typedef enum {
+    NOTE_EVENT_TRIGGER,
+    NOTE_EVENT_RELEASE,
+    NOTE_EVENT_PLAY, // start the song from the bar
+    NOTE_EVENT_STOP, // drop all song notes
+    NOTE_EVENT_CHASE, // song note which started before the PLAY it follows
+} NoteEventType;
+
+typedef struct {
+    NoteEventType type;
+    uint64_t time; // sample position
+    int instrument;
+    int track;
+    int arpeggio;
+    int note;
+    bool song_note;
+    int bar; // NOTE_EVENT_PLAY only
+    uint64_t release; // NOTE_EVENT_CHASE only, UINT64_MAX while held
+} NoteEvent;
+
+// Wait-free single producer / single consumer ring of note events.
+// Only one thread may push (UI) and only one may pop (audio callback)
+typedef struct {
+    unsigned int cap; // power of two
+    NoteEvent *events;
+    atomic_uint head; // next to pop, written by consumer
+    atomic_uint tail; // next to push, written by producer
+} EventQueue;
+
+// cap is rounded up to a power of two
+EventQueue *event_queue_init(unsigned int cap);
+
+// pushes all n events or none of them if there is no room
+bool event_queue_push(EventQueue *queue, NoteEvent const *events, int n);
+
+bool event_queue_pop(EventQueue *queue, NoteEvent *event);
+
+void event_queue_free(EventQueue *queue);
+
+#endif // EVENT_QUEUE_H
@@ -0,0 +1,393 @@
+#include "export.h"
+
+static double export_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void put_u16(unsigned char *bytes, uint16_t value) {
+    bytes[0] = value & 0xff;
+    bytes[1] = value >> 8;
+}
+
+static void put_u32(unsigned char *bytes, uint32_t value) {
+    bytes[0] = value & 0xff;
+    bytes[1] = (value >> 8) & 0xff;
+    bytes[2] = (value >> 16) & 0xff;
+    bytes[3] = value >> 24;
+}
+
+static int sample_size(ExportFormat format) {
+    return format == EXPORT_FORMAT_F32 ? 4 : 2;
+}
+
+// sizes are patched once the data length is known
+static void wav_header(unsigned char *header, ExportFormat format,
+                       int sample_rate, uint32_t data_size) {
+    int size = sample_size(format);
+    int channels = 2;
+
+    memcpy(header, "RIFF", 4);
+    put_u32(header + 4, 36 + data_size);
+    memcpy(header + 8, "WAVE", 4);
+
+    memcpy(header + 12, "fmt ", 4);
+    put_u32(header + 16, 16);
+    put_u16(header + 20, format == EXPORT_FORMAT_F32 ? 3 : 1); // float or PCM
+    put_u16(header + 22, channels);
+    put_u32(header + 24, sample_rate);
+    put_u32(header + 28, sample_rate * channels * size);
+    put_u16(header + 32, channels * size);
+    put_u16(header + 34, size * 8);
+
+    memcpy(header + 36, "data", 4);
+    put_u32(header + 40, data_size);
+}
+
+// returns number of bytes written to bytes, float samples
+// are written as rendered, 16 bit ones are converted here
+static int encode_samples(ExportFormat format, float const *samples, int n,
+                          unsigned char *bytes) {
+    if (format == EXPORT_FORMAT_S16) {
+        short converted[SAMPLE_BUFFER * 2];
+        mixer_to_s16(samples, converted, n);
+        for (int i = 0; i < n; i ++) {
+            put_u16(bytes + i * 2, (uint16_t)converted[i]);
+        }
+        return n * 2;
+    }
+
+    for (int i = 0; i < n; i ++) {
+        uint32_t bits;
+        memcpy(&bits, &samples[i], sizeof(bits));
+        put_u32(bytes + i * 4, bits);
+    }
+    return n * 4;
+}
+
+// chunks write to their own parts of the file, so no locking is needed
+static bool write_at(int fd, unsigned char const *bytes, size_t size,
+                     uint64_t offset) {
+    while (size > 0) {
+        ssize_t written = pwrite(fd, bytes, size, offset);
+        if (written < 0) {
+            return false;
+        }
+        bytes += written;
+        size -= written;
+        offset += written;
+    }
+    return true;
+}
+
+// song is over when its last notes are released and have faded out
+static bool export_finished(AudioContext *ctx) {
+    return !ctx->sequencer->playing && ctx->schedule->length == 0 &&
+           ctx->buffer->length == 0;
+}
+
+// Bars of the song rendered by one context, the last chunk
+// renders the tail as well
+typedef struct {
+    int bar;
+    int end_bar;
+    bool last;
+    uint64_t frames;
+    bool ok;
+} ExportChunk;
+
+typedef struct {
+    State *state;
+    ExportOptions const *options;
+    int fd;
+    ExportChunk *chunks;
+    int count;
+    atomic_int next; // next chunk to take
+} ExportJob;
+
+static bool export_chunk(ExportJob *job, ExportChunk *chunk) {
+    ExportOptions const *options = job->options;
+    AudioContext *ctx = audio_context_init_offline(job->state,
+                                                   options->sample_rate);
+    if (ctx == NULL) {
+        return false;
+    }
+
+    Sequencer *sequencer = ctx->sequencer;
+    sequencer->loop = false;
+
+    // chunk starts at the same sample as it would in a single render,
+    // the first one starts exactly where the single render does
+    uint64_t origin = llround(sequencer_bar_pos(sequencer,
+                                                options->start_bar));
+    uint64_t start = llround(sequencer_bar_pos(sequencer, chunk->bar));
+    uint64_t end = llround(sequencer_bar_pos(sequencer, chunk->end_bar));
+    if (chunk->bar == options->start_bar) {
+        audio_context_play_offline(ctx, chunk->bar, origin);
+    } else {
+        // the pre-roll bounds the work a chunk does before its start
+        int bar = MAX(chunk->bar - options->preroll, options->start_bar);
+        audio_context_seek_offline(ctx, bar, start);
+    }
+
+    float stream[SAMPLE_BUFFER * 2];
+    unsigned char bytes[SAMPLE_BUFFER * 2 * 4];
+    uint64_t max_tail = options->max_tail * options->sample_rate;
+    bool song_ended = false;
+    uint64_t song_end = 0;
+    bool ok = true;
+
+    while (chunk->last || ctx->sample_pos < end) {
+        // tail goes in the same blocks as in a single render
+        uint64_t pos = ctx->sample_pos;
+        int n;
+        if (chunk->last) {
+            n = SAMPLE_BUFFER - (pos - origin) % SAMPLE_BUFFER;
+        } else {
+            n = MIN(end - pos, SAMPLE_BUFFER);
+        }
+
+        typed_audio_callback(ctx, stream, n * 2);
+
+        // sequencer stops a bar ahead of the playback
+        if (!song_ended && !sequencer->playing) {
+            song_ended = true;
+            song_end = llround(sequencer->pos);
+        }
+
+        int size = encode_samples(options->format, stream, n * 2, bytes);
+        uint64_t offset = WAV_HEADER_SIZE + (pos - origin) * 2 *
+                                            sample_size(options->format);
+        if (!write_at(job->fd, bytes, size, offset)) {
+            ok = false;
+            break;
+        }
+        chunk->frames += n;
+
+        if (chunk->last && (export_finished(ctx) ||
+                            (song_ended &&
+                             ctx->sample_pos > song_end + max_tail))) {
+            break;
+        }
+    }
+
+    audio_context_free(ctx);
+    return ok;
+}
+
+static void *export_worker(void *arg) {
+    ExportJob *job = arg;
+    int i;
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->count) {
+        job->chunks[i].ok = export_chunk(job, &job->chunks[i]);
+    }
+    return NULL;
+}
+
+int export_cpu_count(void) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count < 1 ? 1 : count;
+}
+
+bool export_song(State *state, ExportOptions const *options,
+                 ExportStats *stats) {
+    int fd = open(options->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    // shared tables are built once, before the workers read them
+    pitch_table_init();
+    if (!wavetable_init()) {
+        goto cleanup_file;
+    }
+
+    // a single chunk is a seamless render, more of them are rendered
+    // the same way whatever the number of threads is
+    int bars = state->song->length - options->start_bar;
+    int count = 1;
+    if (options->threads > 1) {
+        count = (bars + EXPORT_CHUNK_BARS - 1) / EXPORT_CHUNK_BARS;
+    }
+
+    ExportChunk *chunks = malloc(sizeof(ExportChunk) * count);
+    if (chunks == NULL) {
+        goto cleanup_file;
+    }
+
+    for (int i = 0; i < count; i ++) {
+        int bar = options->start_bar + i * EXPORT_CHUNK_BARS;
+        chunks[i] = (ExportChunk){
+            .bar = bar,
+            .end_bar = MIN(bar + EXPORT_CHUNK_BARS, state->song->length),
+            .last = i == count - 1,
+            .frames = 0,
+            .ok = false};
+    }
+
+    ExportJob job = (ExportJob){
+        .state = state,
+        .options = options,
+        .fd = fd,
+        .chunks = chunks,
+        .count = count};
+    atomic_init(&job.next, 0);
+
+    int threads = MIN(options->threads, count);
+    pthread_t *workers = malloc(sizeof(pthread_t) * threads);
+    if (workers == NULL) {
+        goto cleanup_chunks;
+    }
+
+    // calling thread takes chunks too, workers which failed
+    // to start just leave more of them to the others
+    double start = export_now();
+    int started = 0;
+    for (int i = 1; i < threads; i ++) {
+        if (pthread_create(&workers[started], NULL, export_worker,
+                           &job) == 0) {
+            started += 1;
+        }
+    }
+    export_worker(&job);
+    for (int i = 0; i < started; i ++) {
+        pthread_join(workers[i], NULL);
+    }
+    stats->elapsed = export_now() - start;
+    stats->threads = started + 1;
+    stats->frames = 0;
+
+    bool ok = true;
+    for (int i = 0; i < count; i ++) {
+        ok = ok && chunks[i].ok;
+        stats->frames += chunks[i].frames;
+    }
+
+    uint64_t data_size = stats->frames * 2 * sample_size(options->format);
+    if (!ok || data_size > UINT32_MAX - 36) {
+        goto cleanup_workers;
+    }
+
+    unsigned char header[WAV_HEADER_SIZE];
+    wav_header(header, options->format, options->sample_rate, data_size);
+    if (!write_at(fd, header, WAV_HEADER_SIZE, 0)) {
+        goto cleanup_workers;
+    }
+
+    free(workers);
+    free(chunks);
+    return close(fd) == 0;
+
+cleanup_workers:
+    free(workers);
+cleanup_chunks:
+    free(chunks);
+cleanup_file:
+    close(fd);
+    return false;
+}
+
+static void export_usage(void) {
+    fprintf(stderr, "Usage: trics export [-f] [-b bar] [-t seconds] "
+                    "[-j threads] [-p bars] [-r rate] output.wav\n");
+}
+
+int export_run(int argc, char *argv[]) {
+    ExportOptions options = (ExportOptions){
+        .path = NULL,
+        .format = EXPORT_FORMAT_S16,
+        .start_bar = 0,
+        .max_tail = EXPORT_MAX_TAIL,
+        .threads = export_cpu_count(),
+        .preroll = EXPORT_PREROLL_BARS,
+        .sample_rate = SAMPLE_RATE};
+
+    for (int i = 0; i < argc; i ++) {
+        // threads above the number of chunks are never started
+        int *value = NULL;
+        int min = 0;
+        int max = INT_MAX;
+        if (strcmp(argv[i], "-f") == 0) {
+            options.format = EXPORT_FORMAT_F32;
+            continue;
+        } else if (strcmp(argv[i], "-t") == 0) {
+            if (i + 1 >= argc || !parse_float(argv[i + 1], 0, EXPORT_MAX_TAIL,
+                                              &options.max_tail)) {
+                fprintf(stderr, "-t takes seconds from 0 to %d\n",
+                        EXPORT_MAX_TAIL);
+                return 1;
+            }
+            i += 1;
+            continue;
+        } else if (strcmp(argv[i], "-b") == 0) {
+            value = &options.start_bar;
+            max = MAX_SONG_LENGTH - 1;
+        } else if (strcmp(argv[i], "-j") == 0) {
+            value = &options.threads;
+            min = 1;
+        } else if (strcmp(argv[i], "-p") == 0) {
+            value = &options.preroll;
+            max = MAX_SONG_LENGTH;
+        } else if (strcmp(argv[i], "-r") == 0) {
+            value = &options.sample_rate;
+            min = MIN_SAMPLE_RATE;
+            max = MAX_SAMPLE_RATE;
+        } else if (options.path == NULL && argv[i][0] != '-') {
+            options.path = argv[i];
+            continue;
+        } else {
+            export_usage();
+            return 1;
+        }
+
+        if (i + 1 >= argc || !parse_int(argv[i + 1], min, max, value)) {
+            fprintf(stderr, "%s takes a number from %d to %d\n", argv[i],
+                    min, max);
+            return 1;
+        }
+        i += 1;
+    }
+
+    if (options.path == NULL) {
+        export_usage();
+        return 1;
+    }
+
+    // songs can't be loaded yet, the one the editor starts with is exported
+    State *state = state_init((char *)"Song Title");
+    if (state == NULL) {
+        fprintf(stderr, "Failed to initialize state\n");
+        return 1;
+    }
+
+    int status = 0;
+    if (state->song->length <= 0) {
+        fprintf(stderr, "Song is empty\n");
+        status = 1;
+        goto cleanup;
+    }
+
+    if (options.start_bar >= state->song->length) {
+        fprintf(stderr, "Start bar is out of the song\n");
+        status = 1;
+        goto cleanup;
+    }
+
+    ExportStats stats;
+    if (!export_song(state, &options, &stats)) {
+        fprintf(stderr, "Failed to export to %s\n", options.path);
+        status = 1;
+        goto cleanup;
+    }
+
+    double seconds = (double)stats.frames / options.sample_rate;
+    printf("%s: %.2f s of audio in %.3f s on %d threads "
+           "(%.1fx realtime)\n",
+           options.path, seconds, stats.elapsed, stats.threads,
+           seconds / stats.elapsed);
+
+cleanup:
+    state_free(state);
+    return status;
+}
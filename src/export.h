@@ -0,0 +1,62 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include "audio.h" // AudioContext
+#include "state.h" // State
+#include "util.h" // parse_int
+#include <fcntl.h> // open
+#include <limits.h> // INT_MAX
+#include <pthread.h> // pthread_create
+#include <stdatomic.h> // atomic_int
+#include <stdbool.h> // bool
+#include <stdint.h> // uint64_t
+#include <stdio.h> // printf
+#include <string.h> // memcpy, strcmp
+#include <time.h> // clock_gettime
+#include <unistd.h> // pwrite, sysconf
+
+#define EXPORT_MAX_TAIL ENVELOPE_MAX_RELEASE // seconds after the song end
+#define EXPORT_CHUNK_BARS 4 // bars rendered by one context
+#define EXPORT_PREROLL_BARS 8 // bars a chunk plays before its first one
+#define WAV_HEADER_SIZE 44
+
+typedef enum {
+    EXPORT_FORMAT_S16,
+    EXPORT_FORMAT_F32,
+} ExportFormat;
+
+typedef struct {
+    char const *path;
+    ExportFormat format;
+    int start_bar;
+    float max_tail; // seconds to let notes ring out after the song end
+    int threads; // 1 renders the song at once, otherwise in chunks
+    int preroll; // bars played without output before every chunk
+    int sample_rate;
+} ExportOptions;
+
+typedef struct {
+    uint64_t frames;
+    double elapsed; // seconds of wall time
+    int threads; // actually started
+} ExportStats;
+
+// Renders the song once from the start bar to a WAV file as fast as
+// the CPU allows, without opening an audio device.
+// With more than one thread the song is split in chunks of
+// EXPORT_CHUNK_BARS bars, rendered in parallel by their own contexts.
+// Each one seeks to its start from up to preroll bars before it, rendering
+// only the notes which sound there. Notes triggered within the pre-roll
+// come out the same as in a single render sample for sample, earlier
+// ones are chased like on a playback start.
+// Chunks write to their exact sample offsets in the file
+bool export_song(State *state, ExportOptions const *options,
+                 ExportStats *stats);
+
+// number of online CPUs, at least 1
+int export_cpu_count(void);
+
+// runs export command with its arguments, returns process exit code
+int export_run(int argc, char *argv[]);
+
+#endif // EXPORT_H
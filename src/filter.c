@@ -1,69 +1,156 @@
 #include "filter.h"
 
-LadderFilter *filter_init(int sample_rate) {
-    LadderFilter *filter = malloc(sizeof(LadderFilter));
-    if (filter == NULL) {
-        return NULL;
+void filter_coefficients(FilterCoefficients *c, float cutoff,
+                         int sample_rate) {
+    // keeps the filter stable at low sample rates,
+    // the whole range fits below the limit from 44100 up
+    float f = MIN(2.0 * cutoff / sample_rate, 0.91);
+    c->p = f * (1.8 - 0.8 * f);
+    c->k = 2.0 * sin(f * PI * 0.5) - 1.0;
+    c->t1 = (1.0 - c->p) * 1.386249;
+    c->t2 = 12.0 + c->t1 * c->t1;
+    c->r = 0.8 * (c->t2 + 6.0 * c->t1) / (c->t2 - 6.0 * c->t1);
+    c->feedback = MIN(1.0, cutoff / 2000) * c->r;
+}
+
+void filter_table_init(FilterTable *table, int sample_rate) {
+    table->sample_rate = sample_rate;
+    for (int i = 0; i <= FILTER_TABLE_STEPS; i ++) {
+        float cutoff = (float)i / FILTER_TABLE_STEPS * FILTER_MAX_CUTOFF;
+        filter_coefficients(&table->cutoffs[i], cutoff, sample_rate);
     }
+}
 
-    *filter = (LadderFilter){
-        .sample_rate = sample_rate
-    };
+void filter_bank_reset(FilterBank *bank) {
+    *bank = (FilterBank){ .p = 0, .k = 0, .feedback = 0 };
+}
 
-    for (int i = 0; i < 4; i ++) {
-        filter->s[i] = 0;
-        filter->d[i] = 0;
-    }
+static void filter_bank_process_scalar(FilterBank *bank, float *samples,
+                                      int n) {
+    // the same operations in the same order as SIMD ones, lane by lane
+    for (int i = 0; i < n; i ++) {
+        float *frame = samples + i * FILTER_BANK_LANES;
+        for (int l = 0; l < FILTER_BANK_LANES; l ++) {
+            float (*s)[FILTER_BANK_LANES] = bank->s;
+            float (*d)[FILTER_BANK_LANES] = bank->d;
+            float x = frame[l] - bank->feedback * s[3][l];
 
-    filter_set_cutoff(filter, 20000.0);
+            s[0][l] = x * bank->p + d[0][l] * bank->p - bank->k * s[0][l];
+            s[1][l] = s[0][l] * bank->p + d[1][l] * bank->p -
+                      bank->k * s[1][l];
+            s[2][l] = s[1][l] * bank->p + d[2][l] * bank->p -
+                      bank->k * s[2][l];
+            s[3][l] = s[2][l] * bank->p + d[3][l] * bank->p -
+                      bank->k * s[3][l];
 
-    return filter;
-}
+            float cube = s[3][l] * s[3][l] * s[3][l];
+            s[3][l] -= cube * (1 / 6.0f);
+
+            d[0][l] = x;
+            d[1][l] = s[0][l];
+            d[2][l] = s[1][l];
+            d[3][l] = s[2][l];
 
-// 0 - 1
-void filter_set_resonance(LadderFilter *filter, float r) {
-    if (abs(filter->resonance - r) >= 0.005) {
-        filter->r = 0.8 * r * (filter->t2 + 6.0 * filter->t1) /
-                    (filter->t2 - 6.0 * filter->t1);
-        filter->resonance = r;
+            frame[l] = s[3][l];
+        }
     }
 }
 
-// 0 - 20'000
-void filter_set_cutoff(LadderFilter *filter, float f) {
-    if (abs(filter->cutoff - f) >= 1) {
-        filter->cutoff = f;
-        f = 2.0 * f / filter->sample_rate;
-        filter->p = f * (1.8 - 0.8 * f);
-        filter->k = 2.0 * sin(f * PI * 0.5) - 1.0;
-        filter->t1 = (1.0 - filter->p) * 1.386249;
-        filter->t2 = 12.0 + filter->t1 * filter->t1;
-        filter->resonance = -1;
+#ifdef CPU_X86
+CPU_TARGET_SSE2
+static void filter_bank_process_sse2(FilterBank *bank, float *samples,
+                                     int n) {
+    // state stays in registers for the whole block
+    const __m128 p = _mm_set1_ps(bank->p);
+    const __m128 k = _mm_set1_ps(bank->k);
+    const __m128 feedback = _mm_set1_ps(bank->feedback);
+    const __m128 sixth = _mm_set1_ps(1 / 6.0f);
+    __m128 s0 = _mm_loadu_ps(bank->s[0]);
+    __m128 s1 = _mm_loadu_ps(bank->s[1]);
+    __m128 s2 = _mm_loadu_ps(bank->s[2]);
+    __m128 s3 = _mm_loadu_ps(bank->s[3]);
+    __m128 d0 = _mm_loadu_ps(bank->d[0]);
+    __m128 d1 = _mm_loadu_ps(bank->d[1]);
+    __m128 d2 = _mm_loadu_ps(bank->d[2]);
+    __m128 d3 = _mm_loadu_ps(bank->d[3]);
+
+    for (int i = 0; i < n; i ++) {
+        float *frame = samples + i * FILTER_BANK_LANES;
+        __m128 x = _mm_sub_ps(_mm_loadu_ps(frame), _mm_mul_ps(feedback, s3));
+
+        s0 = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(x, p), _mm_mul_ps(d0, p)),
+                        _mm_mul_ps(k, s0));
+        s1 = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(s0, p), _mm_mul_ps(d1, p)),
+                        _mm_mul_ps(k, s1));
+        s2 = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(s1, p), _mm_mul_ps(d2, p)),
+                        _mm_mul_ps(k, s2));
+        s3 = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(s2, p), _mm_mul_ps(d3, p)),
+                        _mm_mul_ps(k, s3));
+
+        __m128 cube = _mm_mul_ps(_mm_mul_ps(s3, s3), s3);
+        s3 = _mm_sub_ps(s3, _mm_mul_ps(cube, sixth));
+
+        d0 = x;
+        d1 = s0;
+        d2 = s1;
+        d3 = s2;
+
+        _mm_storeu_ps(frame, s3);
     }
+
+    _mm_storeu_ps(bank->s[0], s0);
+    _mm_storeu_ps(bank->s[1], s1);
+    _mm_storeu_ps(bank->s[2], s2);
+    _mm_storeu_ps(bank->s[3], s3);
+    _mm_storeu_ps(bank->d[0], d0);
+    _mm_storeu_ps(bank->d[1], d1);
+    _mm_storeu_ps(bank->d[2], d2);
+    _mm_storeu_ps(bank->d[3], d3);
 }
+#endif
 
-float filter_process(LadderFilter *filter, float s) {
-    float x = s - MIN(1.0, filter->cutoff / 2000) * filter->r * filter->s[3];
+// Lanes of a bank fill one SSE register and the filter is recursive
+// sample to sample, so AVX2 has nothing wider to run
+static const FilterBankKernel filter_bank_kernels[CPU_KERNELS_COUNT] = {
+    [CPU_KERNELS_SCALAR] = filter_bank_process_scalar,
+#ifdef CPU_X86
+    [CPU_KERNELS_SSE2] = filter_bank_process_sse2,
+    [CPU_KERNELS_AVX2] = filter_bank_process_sse2,
+#endif
+};
 
-    filter->s[0] = x * filter->p + filter->d[0]  * filter->p -
-                   filter->k * filter->s[0];
-    filter->s[1] = filter->s[0] * filter->p + filter->d[1] * filter->p -
-                   filter->k * filter->s[1];
-    filter->s[2] = filter->s[1] * filter->p + filter->d[2] * filter->p -
-                   filter->k * filter->s[2];
-    filter->s[3] = filter->s[2] * filter->p + filter->d[3] * filter->p -
-                   filter->k * filter->s[3];
+static FilterBankKernel const *filter_bank_current =
+    &filter_bank_kernels[CPU_KERNELS_BASELINE];
+
+static FilterBankKernel const *filter_bank_entry(CpuKernels kernels) {
+    if (kernels < 0 || kernels >= CPU_KERNELS_COUNT ||
+        filter_bank_kernels[kernels] == NULL) {
+        return &filter_bank_kernels[CPU_KERNELS_SCALAR];
+    }
+    return &filter_bank_kernels[kernels];
+}
 
-    filter->s[3] -= (filter->s[3] * filter->s[3] * filter->s[3]) / 6.0;
+FilterBankKernel filter_bank_kernel(CpuKernels kernels) {
+    return *filter_bank_entry(kernels);
+}
 
-    filter->d[0] = x;
-    filter->d[1] = filter->s[0];
-    filter->d[2] = filter->s[1];
-    filter->d[3] = filter->s[2];
+void filter_use_kernels(CpuKernels kernels) {
+    filter_bank_current = filter_bank_entry(kernels);
+}
 
-    return filter->s[3];
+void filter_bank_process(FilterBank *bank, float *samples, int n) {
+    (*filter_bank_current)(bank, samples, n);
 }
 
-void filter_free(LadderFilter *filter) {
-    free(filter);
+void filter_bank_flush_denormals(FilterBank *bank) {
+    for (int i = 0; i < 4; i ++) {
+        for (int l = 0; l < FILTER_BANK_LANES; l ++) {
+            if (fabs(bank->s[i][l]) < FILTER_DENORMAL_THRESHOLD) {
+                bank->s[i][l] = 0;
+            }
+            if (fabs(bank->d[i][l]) < FILTER_DENORMAL_THRESHOLD) {
+                bank->d[i][l] = 0;
+            }
+        }
+    }
 }
@@ -1,33 +1,90 @@
 #ifndef FILTER_H
 #define FILTER_H
 
+#include "cpu.h" // CpuKernels
 #include "util.h" // PI
-#include <math.h> // sin
-#include <stdlib.h>  // malloc
+#include <math.h> // sin, fabs
+#ifdef CPU_X86
+#include <emmintrin.h> // _mm_mul_ps
+#endif
+
+// states below it are flushed, long before they become subnormal
+#define FILTER_DENORMAL_THRESHOLD 1e-15
+#define FILTER_MAX_CUTOFF 20000.0
+#define FILTER_TABLE_STEPS 1020 // quarter steps of the 1 - 256 parameter
+#define FILTER_BANK_LANES 4 // filters in one SSE register
 
 typedef struct {
-    float s[4];
-    float d[4];
     float p;
     float k;
     float t1;
     float t2;
-    float r;
-    float cutoff;
-    float resonance;
+    float r; // for resonance 1
+    float feedback; // for resonance 1
+} FilterCoefficients;
+
+// Coefficients for every quarter step of the cutoff parameter
+// at one sample rate. Resonance only scales r, so it isn't tabulated
+typedef struct {
     int sample_rate;
-} LadderFilter;
+    FilterCoefficients cutoffs[FILTER_TABLE_STEPS + 1];
+} FilterTable;
+
+void filter_table_init(FilterTable *table, int sample_rate);
+
+// coefficients for the cutoff in Hz, 0 - 20'000, and resonance 1
+void filter_coefficients(FilterCoefficients *c, float cutoff,
+                         int sample_rate);
+
+// Ladder filters running side by side on their own inputs with the same
+// coefficients, as the unison oscillators of a voice do.
+// State is kept as structure of arrays, a lane per filter, so a stage
+// of all filters is one SIMD operation
+typedef struct {
+    float s[4][FILTER_BANK_LANES]; // stage, lane
+    float d[4][FILTER_BANK_LANES];
+    float p;
+    float k;
+    float feedback;
+} FilterBank;
+
+void filter_bank_reset(FilterBank *bank);
+
+// resonance is 0 - 1
+inline static void filter_bank_set_coefficients(FilterBank *bank,
+                                                FilterCoefficients const *c,
+                                                float resonance) {
+    bank->p = c->p;
+    bank->k = c->k;
+    bank->feedback = c->feedback * resonance;
+}
+
+// cutoff and resonance are 0 - 1, cutoff is rounded to the table step
+inline static void filter_bank_set(FilterBank *bank,
+                                   FilterTable const *table,
+                                   float cutoff, float resonance) {
+    int n = (int)(CLAMP(cutoff, 0.0f, 1.0f) * FILTER_TABLE_STEPS + 0.5f);
+    filter_bank_set_coefficients(bank, &table->cutoffs[n], resonance);
+}
 
-LadderFilter *filter_init(int sample_rate);
+// Filters n frames of interleaved lanes in place,
+// sample of the lane l in the frame i is samples[i * FILTER_BANK_LANES + l]
+void filter_bank_process(FilterBank *bank, float *samples, int n);
 
-// 0 - 1
-void filter_set_resonance(LadderFilter *filter, float r);
+typedef void (*FilterBankKernel)(FilterBank *bank, float *samples, int n);
 
-// 0 - 20'000
-void filter_set_cutoff(LadderFilter *filter, float f);
+// filter_bank_process of the set, the scalar one if the set isn't built in
+FilterBankKernel filter_bank_kernel(CpuKernels kernels);
 
-float filter_process(LadderFilter *filter, float s);
+// Makes filter_bank_process run the kernel of the set,
+// the CPU_KERNELS_BASELINE one until then.
+// Called before any thread renders audio
+void filter_use_kernels(CpuKernels kernels);
 
-void filter_free(LadderFilter *filter);
+// Zeroes state of the lanes which has decayed to nothing, so silent
+// tails don't drift into subnormals, which are many times slower to
+// process where flush to zero isn't available. Meant to be called
+// once a block
+void filter_bank_flush_denormals(FilterBank *bank);
 
 #endif // FILTER_H
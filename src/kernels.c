@@ -0,0 +1,193 @@
+#include "kernels.h"
+
+static CpuKernels kernels_in_use = CPU_KERNELS_BASELINE;
+
+// deterministic noise in -range..range
+static void kernels_fill(float *samples, int n, float range,
+                         unsigned int *seed) {
+    for (int i = 0; i < n; i ++) {
+        *seed = *seed * 1103515245 + 12345;
+        samples[i] = ((float)(*seed >> 16) / 32768 - 1) * range;
+    }
+}
+
+static bool kernels_match(float const *samples, float const *expected,
+                          int n) {
+    for (int i = 0; i < n; i ++) {
+        float tolerance = KERNELS_TEST_TOLERANCE * MAX(1.0, fabs(expected[i]));
+        if (!(fabs(samples[i] - expected[i]) <= tolerance)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool kernels_test_mixer(MixerKernels const *mixer,
+                               MixerKernels const *reference) {
+    const int n = KERNELS_TEST_FRAMES;
+    float src[KERNELS_TEST_FRAMES];
+    float left[KERNELS_TEST_FRAMES];
+    float right[KERNELS_TEST_FRAMES];
+    float expected[KERNELS_TEST_FRAMES];
+    unsigned int seed = 1;
+
+    kernels_fill(src, n, 1, &seed);
+    kernels_fill(left, n, 1, &seed);
+    memcpy(expected, left, sizeof(expected));
+    mixer->add(left, src, 0.7, n);
+    reference->add(expected, src, 0.7, n);
+    if (!kernels_match(left, expected, n)) {
+        return false;
+    }
+
+    // past the clip threshold as well
+    float stream[KERNELS_TEST_FRAMES * 2];
+    float expected_stream[KERNELS_TEST_FRAMES * 2];
+    kernels_fill(left, n, 1.5, &seed);
+    kernels_fill(right, n, 1.5, &seed);
+    mixer->output(left, right, stream, n);
+    reference->output(left, right, expected_stream, n);
+    if (!kernels_match(stream, expected_stream, n * 2)) {
+        return false;
+    }
+
+    short out[KERNELS_TEST_FRAMES * 2];
+    short expected_out[KERNELS_TEST_FRAMES * 2];
+    mixer->to_s16(expected_stream, out, n * 2);
+    reference->to_s16(expected_stream, expected_out, n * 2);
+    for (int i = 0; i < n * 2; i ++) {
+        if (abs(out[i] - expected_out[i]) > 1) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// a resonant bank over several blocks, so its state is carried over
+static bool kernels_test_filter_bank(FilterBankKernel process,
+                                     FilterBankKernel reference) {
+    const int n = KERNELS_TEST_FRAMES;
+    static FilterTable table;
+    filter_table_init(&table, KERNELS_TEST_RATE);
+
+    FilterBank bank;
+    FilterBank expected;
+    filter_bank_reset(&bank);
+    filter_bank_reset(&expected);
+
+    float lanes[KERNELS_TEST_FRAMES * FILTER_BANK_LANES];
+    float expected_lanes[KERNELS_TEST_FRAMES * FILTER_BANK_LANES];
+    unsigned int seed = 1;
+    for (int b = 0; b < KERNELS_TEST_BLOCKS; b ++) {
+        float cutoff = (float)(b + 1) / (KERNELS_TEST_BLOCKS + 1);
+        filter_bank_set(&bank, &table, cutoff, 0.9);
+        filter_bank_set(&expected, &table, cutoff, 0.9);
+
+        kernels_fill(lanes, n * FILTER_BANK_LANES, 1, &seed);
+        memcpy(expected_lanes, lanes, sizeof(lanes));
+        process(&bank, lanes, n);
+        reference(&expected, expected_lanes, n);
+        if (!kernels_match(lanes, expected_lanes, n * FILTER_BANK_LANES) ||
+            !kernels_match(bank.s[0], expected.s[0],
+                           4 * FILTER_BANK_LANES) ||
+            !kernels_match(bank.d[0], expected.d[0],
+                           4 * FILTER_BANK_LANES)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// oscillators of different forms, levels and pitches over several
+// blocks, some of them starting just below a wrap
+static bool kernels_test_wavetable_bank(WavetableBankKernel read,
+                                        WavetableBankKernel reference) {
+    const int n = KERNELS_TEST_FRAMES;
+    if (!wavetable_init()) {
+        return false;
+    }
+
+    float const *tables[WAVETABLE_BANK_LANES];
+    float phases[WAVETABLE_BANK_LANES];
+    float expected_phases[WAVETABLE_BANK_LANES];
+    float increments[WAVETABLE_BANK_LANES];
+    unsigned int seed = 1;
+    kernels_fill(phases, WAVETABLE_BANK_LANES, 0.5, &seed);
+    kernels_fill(increments, WAVETABLE_BANK_LANES, 0.05, &seed);
+    for (int l = 0; l < WAVETABLE_BANK_LANES; l ++) {
+        tables[l] = wavetable_get(l % WAVETABLE_FORMS,
+                                  l * WAVETABLE_LEVELS / WAVETABLE_BANK_LANES);
+        phases[l] = l == 0 ? 1 - 1e-8 : phases[l] + 0.5;
+        increments[l] = fabs(increments[l]) + (l == 1 ? 0.9 : 0);
+    }
+    memcpy(expected_phases, phases, sizeof(phases));
+
+    float lanes[KERNELS_TEST_FRAMES * WAVETABLE_BANK_LANES];
+    float expected_lanes[KERNELS_TEST_FRAMES * WAVETABLE_BANK_LANES];
+    for (int b = 0; b < KERNELS_TEST_BLOCKS; b ++) {
+        read(phases, increments, tables, lanes, n);
+        reference(expected_phases, increments, tables, expected_lanes, n);
+        if (!kernels_match(lanes, expected_lanes,
+                           n * WAVETABLE_BANK_LANES) ||
+            !kernels_match(phases, expected_phases, WAVETABLE_BANK_LANES)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool kernels_self_test(CpuKernels kernels) {
+    if (!cpu_kernels_supported(kernels)) {
+        return false;
+    }
+
+    return kernels_test_mixer(mixer_kernels(kernels),
+                              mixer_kernels(CPU_KERNELS_SCALAR)) &&
+           kernels_test_filter_bank(filter_bank_kernel(kernels),
+                                    filter_bank_kernel(CPU_KERNELS_SCALAR)) &&
+           kernels_test_wavetable_bank(
+               wavetable_bank_kernel(kernels),
+               wavetable_bank_kernel(CPU_KERNELS_SCALAR));
+}
+
+CpuKernels kernels_init(void) {
+    // scalar ones are the reference, they always pass
+    CpuKernels kernels = CPU_KERNELS_COUNT - 1;
+    while (kernels > CPU_KERNELS_SCALAR && !kernels_self_test(kernels)) {
+        kernels -= 1;
+    }
+
+    mixer_use_kernels(kernels);
+    filter_use_kernels(kernels);
+    wavetable_use_kernels(kernels);
+    kernels_in_use = kernels;
+    return kernels;
+}
+
+CpuKernels kernels_current(void) {
+    return kernels_in_use;
+}
+
+int kernels_info(void) {
+    unsigned int features = cpu_features();
+    printf("cpu:%s%s\n", features & CPU_FEATURE_SSE2 ? " sse2" : "",
+           features & CPU_FEATURE_AVX2 ? " avx2" : "");
+
+    int status = 0;
+    for (int i = 0; i < CPU_KERNELS_COUNT; i ++) {
+        char const *result = "self-test passed";
+        if (!cpu_kernels_supported(i)) {
+            result = "not supported";
+        } else if (!kernels_self_test(i)) {
+            result = "self-test FAILED";
+            status = 1;
+        }
+        printf("%-8s %s\n", cpu_kernels_name(i), result);
+    }
+
+    printf("kernels: %s\n", cpu_kernels_name(kernels_current()));
+    return status;
+}
@@ -0,0 +1,36 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include "cpu.h" // CpuKernels, cpu_features
+#include "filter.h" // FilterBankKernel
+#include "mixer.h" // MixerKernels
+#include "util.h" // MAX
+#include "wavetable.h" // WavetableBankKernel
+#include <math.h> // fabs
+#include <stdbool.h> // bool
+#include <stdio.h> // printf
+#include <stdlib.h> // abs
+#include <string.h> // memcpy
+
+#define KERNELS_TEST_FRAMES 67 // leaves a tail after every vector width
+#define KERNELS_TEST_BLOCKS 8
+#define KERNELS_TEST_RATE 44100
+#define KERNELS_TEST_TOLERANCE 1e-4 // relative, scalar code may fuse ops
+
+// Runs kernels of the set and the scalar ones on the same input,
+// true if the results agree. False if the CPU doesn't run the set
+bool kernels_self_test(CpuKernels kernels);
+
+// Picks the widest kernel set the CPU runs which passes its self-test
+// and makes the DSP code use it. Called once at startup, before any
+// thread renders audio, returns the set
+CpuKernels kernels_init(void);
+
+// set picked by kernels_init, CPU_KERNELS_BASELINE before it
+CpuKernels kernels_current(void);
+
+// Prints CPU features, self-test results of every kernel set
+// and the set in use, returns process exit code
+int kernels_info(void);
+
+#endif // KERNELS_H
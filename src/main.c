@@ -3,6 +3,10 @@
 #include "ui_interface.h"
 #include "audio.h"
 #include "render.h"
+#include "bench.h"
+#include "export.h"
+#include "kernels.h"
+#include <limits.h> // INT_MAX
 #include <ncurses.h> // ncurses functions
 #include <signal.h>  // signal
 #include <stdbool.h>  // bool
@@ -11,6 +15,7 @@
 #include <unistd.h>  // STDIN_FILENO
 #include <stdio.h>  // fprintf
 #include <stdlib.h>  // exit
+#include <string.h>  // strcmp
 
 static WINDOW *win;
 
@@ -58,6 +63,50 @@ void sleep_msec(int ms) {
 }
 
 int main(int argc, char *argv[]) {
+    kernels_init();
+
+    if (argc > 1 && strcmp(argv[1], "--cpu-info") == 0) {
+        return kernels_info();
+    }
+
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        return bench_run(argc - 2, argv + 2);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "export") == 0) {
+        return export_run(argc - 2, argv + 2);
+    }
+
+    int render_threads = 1;
+    int sample_rate = SAMPLE_RATE;
+    int buffer = SAMPLE_BUFFER;
+    for (int i = 1; i < argc; i ++) {
+        // threads above the CPU count are clamped when the workers start
+        int *value = NULL;
+        int min = 1;
+        int max = INT_MAX;
+        if (strcmp(argv[i], "-j") == 0) {
+            value = &render_threads;
+        } else if (strcmp(argv[i], "--rate") == 0) {
+            value = &sample_rate;
+            min = MIN_SAMPLE_RATE;
+            max = MAX_SAMPLE_RATE;
+        } else if (strcmp(argv[i], "--buffer") == 0) {
+            value = &buffer;
+            min = MIN_DEVICE_BUFFER;
+            max = MAX_DEVICE_BUFFER;
+        } else {
+            continue;
+        }
+
+        if (i + 1 >= argc || !parse_int(argv[i + 1], min, max, value)) {
+            fprintf(stderr, "%s takes a number from %d to %d\n", argv[i],
+                    min, max);
+            return 1;
+        }
+        i += 1;
+    }
+
     renderer_setup();
     Widget *table = widget_init_container(NULL, NULL, (Rect){ .x = 1, .y = 5, .width = 10, .height = 10 });
 
@@ -89,76 +138,19 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
 
-    AudioContext *ctx = audio_context_init(state);
-    audio_context_play(ctx, 0);
-    /*
-
-    int start = SDL_GetTicks();
-
-    int max = SAMPLE_RATE * 30;
-    int e = 0;
-    int fu = 0;
-    int bu = 0;
-    while (e < max) {
-        int prev = e;
-        e += 1024;
-        if (prev / (SAMPLE_RATE / 2) != e / (SAMPLE_RATE / 2)) {
-            if(audio_context_trigger_step(ctx, 1, 1, 59 -12 * 3  , 1, 1)) {
-        int dbu = ctx->buffer_update_count - bu;
-        int dfu = ctx->frames_update_count - fu;
-        bu = ctx->buffer_update_count;
-        fu = ctx->frames_update_count;
-        printf("buffer: %d, queue: %d time: %f base_rate: %f  bu/s: %f  fu/s: %f\n", ctx->buffer->length, ctx->queue->length, ctx->time, 1 / 0.5, dbu / 0.5, dfu / 0.5);
-            }
-        }
-
-        short * stream = malloc(sizeof(short) * 1024);
-        typed_audio_callback(ctx, stream, 1024);
-        free(stream);
+    AudioContext *ctx = audio_context_init(state, sample_rate, buffer);
+    if (ctx == NULL) {
+        fprintf(stderr, "Failed to initialize audio\n");
+        exit(1);
     }
 
-    int elapsed = SDL_GetTicks() - start;
-    float total = ((float)(max) / 2 / (float)SAMPLE_RATE);
-    float load = (float)elapsed / 1000.0 / total;
-    printf("%d %d %f of %f\n", max, elapsed, load, total);
-
-    return 0;
-
-
-    int i = 0;
-    int fu = 0;
-    int bu = 0;
-    float delay = 60.0 / 128. / 2;
-    while (true) {
-        i += 1;
-
-        if(!audio_context_trigger_step(ctx, 1, 1, 59 -12 * 3  , 1, 15)) {
-            printf("FAILED NOTE \n");
-        }
-        int dbu = ctx->buffer_update_count - bu;
-        int dfu = ctx->frames_update_count - fu;
-        bu = ctx->buffer_update_count;
-        fu = ctx->frames_update_count;
-        printf("buffer: %d, queue: %d time: %f base_rate: %f  bu/s: %f  fu/s: %f\n", ctx->buffer->length, ctx->queue->length, ctx->time, 1 / delay, dbu / delay, dfu / delay);
-        SDL_Delay(1000.0 * delay);
-
-        if (i > 400) {
-            break;
-        }
-
-        printf("%d of 400\n", i);
-
-       
+    // tracks are still rendered, only on the audio thread alone
+    if (!audio_context_start_workers(ctx, render_threads)) {
+        fprintf(stderr, "Failed to start render threads, using one\n");
     }
+    audio_context_play(ctx, 0);
 
-    printf("b %d  f %d\n", ctx->buffer_update_count, ctx->frames_update_count);
-
-    return 0;
-
-    */
-
-
-    Interface *interface = interface_init(state);
+    Interface *interface = interface_init(state, ctx);
 
     if (interface == NULL) {
         fprintf(stderr, "Failed to initialize interface\n");
@@ -0,0 +1,243 @@
+#include "mixer.h"
+
+// samples above it are clipped, below it are shaped by a sine quarter
+static const float clip_threshold = 2.0 / 3.;
+static const float clip_scale = 3 * PI / 4.0;
+
+MixerGains mixer_gains(int volume, int pan) {
+    float vol = NORM((float)volume, MIN_PARAM, MAX_PARAM);
+    float p = NORM((float)pan, MIN_PARAM, MAX_PARAM);
+    float pd = fabs(p - 0.5);
+
+    return (MixerGains){
+        .left = vol * (1 - p) * (-pd + 1) * 2,
+        .right = vol * p * (-pd + 1) * 2};
+}
+
+void mixer_clear(float *bus, int n) {
+    for (int i = 0; i < n; i ++) {
+        bus[i] = 0.0;
+    }
+}
+
+static void mixer_add_scalar(float *dst, float const *src, float gain,
+                             int n) {
+    for (int i = 0; i < n; i ++) {
+        dst[i] += src[i] * gain;
+    }
+}
+
+// sin on -pi/2..pi/2, odd polynomial is within 4e-6 of it,
+// SIMD and scalar paths use the same one so they agree
+inline static float clip_sin_poly(float x) {
+    float x2 = x * x;
+    return x * (1 + x2 * (-1 / 6.0f + x2 * (1 / 120.0f +
+           x2 * (-1 / 5040.0f + x2 * (1 / 362880.0f)))));
+}
+
+inline static float clip_sin(float x) {
+    if (fabs(x) <= clip_threshold) {
+        return clip_sin_poly(x * clip_scale);
+    } else {
+        return x < 0 ? -1.0 : 1.0;
+    }
+}
+
+static void mixer_output_scalar(float const *left, float const *right,
+                                float *stream, int n) {
+    for (int i = 0; i < n; i ++) {
+        stream[i * 2] = clip_sin(left[i]);
+        stream[i * 2 + 1] = clip_sin(right[i]);
+    }
+}
+
+static void mixer_to_s16_scalar(float const *samples, short *out, int n) {
+    for (int i = 0; i < n; i ++) {
+        out[i] = floor(samples[i] * MIXER_MAX_VALUE);
+    }
+}
+
+#ifdef CPU_X86
+CPU_TARGET_SSE2
+static void mixer_add_sse2(float *dst, float const *src, float gain, int n) {
+    int i = 0;
+    __m128 g = _mm_set1_ps(gain);
+    for (; i + 4 <= n; i += 4) {
+        __m128 d = _mm_loadu_ps(dst + i);
+        __m128 s = _mm_loadu_ps(src + i);
+        _mm_storeu_ps(dst + i, _mm_add_ps(d, _mm_mul_ps(s, g)));
+    }
+    mixer_add_scalar(dst + i, src + i, gain, n - i);
+}
+
+CPU_TARGET_SSE2
+inline static __m128 clip_sin_ps(__m128 x) {
+    const __m128 sign_mask = _mm_set1_ps(-0.0f);
+    __m128 sign = _mm_and_ps(x, sign_mask);
+    __m128 clipped = _mm_cmpgt_ps(_mm_andnot_ps(sign_mask, x),
+                                  _mm_set1_ps(clip_threshold));
+
+    __m128 t = _mm_mul_ps(x, _mm_set1_ps(clip_scale));
+    __m128 t2 = _mm_mul_ps(t, t);
+    __m128 p = _mm_set1_ps(1 / 362880.0f);
+    p = _mm_add_ps(_mm_mul_ps(p, t2), _mm_set1_ps(-1 / 5040.0f));
+    p = _mm_add_ps(_mm_mul_ps(p, t2), _mm_set1_ps(1 / 120.0f));
+    p = _mm_add_ps(_mm_mul_ps(p, t2), _mm_set1_ps(-1 / 6.0f));
+    p = _mm_add_ps(_mm_mul_ps(p, t2), _mm_set1_ps(1));
+    __m128 y = _mm_mul_ps(t, p);
+
+    __m128 limit = _mm_or_ps(sign, _mm_set1_ps(1.0f));
+    return _mm_or_ps(_mm_and_ps(clipped, limit),
+                     _mm_andnot_ps(clipped, y));
+}
+
+// truncation is fixed up to floor for negative values
+CPU_TARGET_SSE2
+inline static __m128i floor_epi32(__m128 x) {
+    __m128i t = _mm_cvttps_epi32(x);
+    __m128 above = _mm_cmpgt_ps(_mm_cvtepi32_ps(t), x);
+    return _mm_add_epi32(t, _mm_castps_si128(above));
+}
+
+CPU_TARGET_SSE2
+static void mixer_output_sse2(float const *left, float const *right,
+                              float *stream, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 l = clip_sin_ps(_mm_loadu_ps(left + i));
+        __m128 r = clip_sin_ps(_mm_loadu_ps(right + i));
+        _mm_storeu_ps(stream + i * 2, _mm_unpacklo_ps(l, r));
+        _mm_storeu_ps(stream + i * 2 + 4, _mm_unpackhi_ps(l, r));
+    }
+    mixer_output_scalar(left + i, right + i, stream + i * 2, n - i);
+}
+
+CPU_TARGET_SSE2
+static void mixer_to_s16_sse2(float const *samples, short *out, int n) {
+    int i = 0;
+    const __m128 scale = _mm_set1_ps(MIXER_MAX_VALUE);
+    for (; i + 8 <= n; i += 8) {
+        __m128i lo = floor_epi32(_mm_mul_ps(_mm_loadu_ps(samples + i),
+                                            scale));
+        __m128i hi = floor_epi32(_mm_mul_ps(_mm_loadu_ps(samples + i + 4),
+                                            scale));
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(lo, hi));
+    }
+    mixer_to_s16_scalar(samples + i, out + i, n - i);
+}
+
+// AVX2 ones do the same operations as SSE2 ones on 8 samples,
+// multiplies and adds aren't fused so the results stay the same
+
+CPU_TARGET_AVX2
+static void mixer_add_avx2(float *dst, float const *src, float gain, int n) {
+    int i = 0;
+    __m256 g = _mm256_set1_ps(gain);
+    for (; i + 8 <= n; i += 8) {
+        __m256 d = _mm256_loadu_ps(dst + i);
+        __m256 s = _mm256_loadu_ps(src + i);
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(d, _mm256_mul_ps(s, g)));
+    }
+    mixer_add_sse2(dst + i, src + i, gain, n - i);
+}
+
+CPU_TARGET_AVX2
+inline static __m256 clip_sin_ps256(__m256 x) {
+    const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+    __m256 sign = _mm256_and_ps(x, sign_mask);
+    __m256 clipped = _mm256_cmp_ps(_mm256_andnot_ps(sign_mask, x),
+                                   _mm256_set1_ps(clip_threshold),
+                                   _CMP_GT_OQ);
+
+    __m256 t = _mm256_mul_ps(x, _mm256_set1_ps(clip_scale));
+    __m256 t2 = _mm256_mul_ps(t, t);
+    __m256 p = _mm256_set1_ps(1 / 362880.0f);
+    p = _mm256_add_ps(_mm256_mul_ps(p, t2), _mm256_set1_ps(-1 / 5040.0f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, t2), _mm256_set1_ps(1 / 120.0f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, t2), _mm256_set1_ps(-1 / 6.0f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, t2), _mm256_set1_ps(1));
+    __m256 y = _mm256_mul_ps(t, p);
+
+    __m256 limit = _mm256_or_ps(sign, _mm256_set1_ps(1.0f));
+    return _mm256_blendv_ps(y, limit, clipped);
+}
+
+CPU_TARGET_AVX2
+static void mixer_output_avx2(float const *left, float const *right,
+                              float *stream, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 l = clip_sin_ps256(_mm256_loadu_ps(left + i));
+        __m256 r = clip_sin_ps256(_mm256_loadu_ps(right + i));
+        // unpacking interleaves within the 128 bit halves only
+        __m256 lo = _mm256_unpacklo_ps(l, r);
+        __m256 hi = _mm256_unpackhi_ps(l, r);
+        _mm256_storeu_ps(stream + i * 2, _mm256_permute2f128_ps(lo, hi, 0x20));
+        _mm256_storeu_ps(stream + i * 2 + 8,
+                         _mm256_permute2f128_ps(lo, hi, 0x31));
+    }
+    mixer_output_sse2(left + i, right + i, stream + i * 2, n - i);
+}
+
+CPU_TARGET_AVX2
+static void mixer_to_s16_avx2(float const *samples, short *out, int n) {
+    int i = 0;
+    const __m256 scale = _mm256_set1_ps(MIXER_MAX_VALUE);
+    for (; i + 16 <= n; i += 16) {
+        __m256 lo = _mm256_mul_ps(_mm256_loadu_ps(samples + i), scale);
+        __m256 hi = _mm256_mul_ps(_mm256_loadu_ps(samples + i + 8), scale);
+        __m256i packed = _mm256_packs_epi32(
+            _mm256_cvttps_epi32(_mm256_floor_ps(lo)),
+            _mm256_cvttps_epi32(_mm256_floor_ps(hi)));
+        // packing works within the 128 bit halves as well
+        _mm256_storeu_si256((__m256i *)(out + i),
+                            _mm256_permute4x64_epi64(packed, 0xd8));
+    }
+    mixer_to_s16_sse2(samples + i, out + i, n - i);
+}
+#endif
+
+static const MixerKernels mixer_kernel_sets[CPU_KERNELS_COUNT] = {
+    [CPU_KERNELS_SCALAR] = {
+        .add = mixer_add_scalar,
+        .output = mixer_output_scalar,
+        .to_s16 = mixer_to_s16_scalar},
+#ifdef CPU_X86
+    [CPU_KERNELS_SSE2] = {
+        .add = mixer_add_sse2,
+        .output = mixer_output_sse2,
+        .to_s16 = mixer_to_s16_sse2},
+    [CPU_KERNELS_AVX2] = {
+        .add = mixer_add_avx2,
+        .output = mixer_output_avx2,
+        .to_s16 = mixer_to_s16_avx2},
+#endif
+};
+
+static MixerKernels const *mixer_current =
+    &mixer_kernel_sets[CPU_KERNELS_BASELINE];
+
+MixerKernels const *mixer_kernels(CpuKernels kernels) {
+    if (kernels < 0 || kernels >= CPU_KERNELS_COUNT ||
+        mixer_kernel_sets[kernels].add == NULL) {
+        return &mixer_kernel_sets[CPU_KERNELS_SCALAR];
+    }
+    return &mixer_kernel_sets[kernels];
+}
+
+void mixer_use_kernels(CpuKernels kernels) {
+    mixer_current = mixer_kernels(kernels);
+}
+
+void mixer_add(float *dst, float const *src, float gain, int n) {
+    mixer_current->add(dst, src, gain, n);
+}
+
+void mixer_output(float const *left, float const *right, float *stream,
+                  int n) {
+    mixer_current->output(left, right, stream, n);
+}
+
+void mixer_to_s16(float const *samples, short *out, int n) {
+    mixer_current->to_s16(samples, out, n);
+}
@@ -0,0 +1,54 @@
+#ifndef MIXER_H
+#define MIXER_H
+
+#include "cpu.h" // CpuKernels
+#include "state.h" // MIN_PARAM, MAX_PARAM
+#include "util.h" // NORM, PI
+#include <math.h> // fabs, floor
+#ifdef CPU_X86
+#include <immintrin.h> // _mm_add_ps, _mm256_add_ps
+#endif
+
+#define MIXER_MAX_VALUE 32767 // of 16 bit samples
+#define MIXER_HEADROOM 0.4 // - ~ 4db on every track
+
+// mixing functions built for one instruction set
+typedef struct {
+    void (*add)(float *dst, float const *src, float gain, int n);
+    void (*output)(float const *left, float const *right, float *stream,
+                   int n);
+    void (*to_s16)(float const *samples, short *out, int n);
+} MixerKernels;
+
+// gains of a bus, applied once per block
+typedef struct {
+    float left;
+    float right;
+} MixerGains;
+
+// volume and pan are parameters in MIN_PARAM..MAX_PARAM,
+// with the same pan law as instruments have
+MixerGains mixer_gains(int volume, int pan);
+
+void mixer_clear(float *bus, int n);
+
+// adds n samples of src scaled by gain to dst
+void mixer_add(float *dst, float const *src, float gain, int n);
+
+// Soft clips n frames of the master bus into -1..1 and writes them
+// to the stream interleaved
+void mixer_output(float const *left, float const *right, float *stream,
+                  int n);
+
+// converts n samples in -1..1 to 16 bit ones, for the exporters
+void mixer_to_s16(float const *samples, short *out, int n);
+
+// kernels of the set, the scalar ones if the set isn't built in
+MixerKernels const *mixer_kernels(CpuKernels kernels);
+
+// Makes mixer_add, mixer_output and mixer_to_s16 run the kernels
+// of the set, CPU_KERNELS_BASELINE ones until then.
+// Called before any thread renders audio
+void mixer_use_kernels(CpuKernels kernels);
+
+#endif // MIXER_H
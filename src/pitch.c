@@ -0,0 +1,39 @@
+#include "pitch.h"
+
+static float pitch_table[PITCH_TABLE_SIZE];
+
+static bool pitch_table_ready = false;
+
+void pitch_table_init(void) {
+    if (pitch_table_ready) {
+        return;
+    }
+
+    for (int i = 0; i < PITCH_TABLE_SIZE; i ++) {
+        pitch_table[i] = pitch_freq_pow((float)i / PITCH_TABLE_STEPS);
+    }
+
+    pitch_table_ready = true;
+}
+
+float pitch_freq(float note) {
+    float x = note * PITCH_TABLE_STEPS;
+    int i = (int)x;
+    if (x < 0 || i >= PITCH_TABLE_SIZE - 1) {
+        return pitch_freq_pow(note);
+    }
+
+    // operators move pitch by quarter semitones so most of the time
+    // it's an exact hit, interpolate in between
+    float d = x - i;
+    if (d == 0) {
+        return pitch_table[i];
+    }
+
+    return pitch_table[i] + (pitch_table[i + 1] - pitch_table[i]) * d;
+}
+
+float pitch_freq_pow(float note) {
+    float dn = note - PITCH_REF_NOTE;
+    return PITCH_REF_FREQ * pow(TETT, dn);
+}
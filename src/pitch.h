@@ -0,0 +1,23 @@
+#ifndef PITCH_H
+#define PITCH_H
+
+#include "state.h" // MAX_NOTE
+#include <math.h> // pow
+
+#define TETT 1.0594630943592953  // 2 ^ (1 / 12)
+#define PITCH_REF_NOTE 58 // A4 440
+#define PITCH_REF_FREQ 440
+#define PITCH_TABLE_STEPS 4 // quarter semitones
+
+// note + hard sync + ring mod can reach 3 * MAX_NOTE
+#define PITCH_TABLE_SIZE (3 * MAX_NOTE * PITCH_TABLE_STEPS + 1)
+
+void pitch_table_init(void);
+
+// frequency of the note, notes are numbered from 0, may be fractional
+float pitch_freq(float note);
+
+// reference implementation, calculates frequency directly with pow
+float pitch_freq_pow(float note);
+
+#endif // PITCH_H
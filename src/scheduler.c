@@ -0,0 +1,124 @@
+#include "scheduler.h"
+
+Scheduler *scheduler_init(int cap) {
+    ScheduledEvent *events = malloc(sizeof(ScheduledEvent) * cap);
+    if (events == NULL) {
+        return NULL;
+    }
+
+    Scheduler *scheduler = malloc(sizeof(Scheduler));
+    if (scheduler == NULL) {
+        free(events);
+        return NULL;
+    }
+
+    *scheduler = (Scheduler){
+        .cap = cap,
+        .length = 0,
+        .seq = 0,
+        .events = events};
+
+    return scheduler;
+}
+
+inline static bool scheduled_before(ScheduledEvent const *a,
+                                    ScheduledEvent const *b) {
+    if (a->event.time != b->event.time) {
+        return a->event.time < b->event.time;
+    }
+    return a->seq < b->seq;
+}
+
+static void scheduler_sift_up(Scheduler *scheduler, int i) {
+    ScheduledEvent *events = scheduler->events;
+    ScheduledEvent item = events[i];
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!scheduled_before(&item, &events[parent])) {
+            break;
+        }
+        events[i] = events[parent];
+        i = parent;
+    }
+    events[i] = item;
+}
+
+static void scheduler_sift_down(Scheduler *scheduler, int i) {
+    ScheduledEvent *events = scheduler->events;
+    int length = scheduler->length;
+    ScheduledEvent item = events[i];
+    while (true) {
+        int child = i * 2 + 1;
+        if (child >= length) {
+            break;
+        }
+        if (child + 1 < length &&
+            scheduled_before(&events[child + 1], &events[child])) {
+            child += 1;
+        }
+        if (!scheduled_before(&events[child], &item)) {
+            break;
+        }
+        events[i] = events[child];
+        i = child;
+    }
+    events[i] = item;
+}
+
+bool scheduler_push(Scheduler *scheduler, NoteEvent const *event) {
+    if (scheduler->length >= scheduler->cap) {
+        return false;
+    }
+
+    int i = scheduler->length;
+    scheduler->events[i] = (ScheduledEvent){
+        .event = *event,
+        .seq = scheduler->seq};
+    scheduler->seq += 1;
+    scheduler->length += 1;
+    scheduler_sift_up(scheduler, i);
+    return true;
+}
+
+NoteEvent *scheduler_peek(Scheduler *scheduler) {
+    if (scheduler->length == 0) {
+        return NULL;
+    }
+    return &scheduler->events[0].event;
+}
+
+bool scheduler_pop(Scheduler *scheduler, NoteEvent *event) {
+    if (scheduler->length == 0) {
+        return false;
+    }
+
+    *event = scheduler->events[0].event;
+    scheduler->length -= 1;
+    if (scheduler->length > 0) {
+        scheduler->events[0] = scheduler->events[scheduler->length];
+        scheduler_sift_down(scheduler, 0);
+    }
+    return true;
+}
+
+void scheduler_filter(Scheduler *scheduler,
+                      bool (*keep)(NoteEvent const *event)) {
+    int length = 0;
+    for (int i = 0; i < scheduler->length; i ++) {
+        if (keep(&scheduler->events[i].event)) {
+            scheduler->events[length] = scheduler->events[i];
+            length += 1;
+        }
+    }
+    scheduler->length = length;
+
+    // heapify
+    for (int i = length / 2 - 1; i >= 0; i --) {
+        scheduler_sift_down(scheduler, i);
+    }
+}
+
+void scheduler_free(Scheduler *scheduler) {
+    free(scheduler->events);
+    free(scheduler);
+}
@@ -0,0 +1,38 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "event_queue.h" // NoteEvent
+#include <stdbool.h> // bool
+#include <stdlib.h> // malloc
+
+typedef struct {
+    NoteEvent event;
+    unsigned long seq; // keeps events with equal time in push order
+} ScheduledEvent;
+
+// Binary min-heap of note events keyed by time,
+// push and pop are O(log n), next event is always on the top
+typedef struct {
+    int cap;
+    int length;
+    unsigned long seq;
+    ScheduledEvent *events;
+} Scheduler;
+
+Scheduler *scheduler_init(int cap);
+
+// fails if the scheduler is full
+bool scheduler_push(Scheduler *scheduler, NoteEvent const *event);
+
+// returns the earliest event without removing it, NULL if empty
+NoteEvent *scheduler_peek(Scheduler *scheduler);
+
+bool scheduler_pop(Scheduler *scheduler, NoteEvent *event);
+
+// drops events for which keep returns false, O(n)
+void scheduler_filter(Scheduler *scheduler,
+                      bool (*keep)(NoteEvent const *event));
+
+void scheduler_free(Scheduler *scheduler);
+
+#endif // SCHEDULER_H
@@ -0,0 +1,325 @@
+#include "sequencer.h"
+
+Sequencer *sequencer_init(State *state, int sample_rate) {
+    Timeline *timeline = timeline_init(state);
+    if (timeline == NULL) {
+        return NULL;
+    }
+
+    Sequencer *sequencer = malloc(sizeof(Sequencer));
+    if (sequencer == NULL) {
+        timeline_free(timeline);
+        return NULL;
+    }
+
+    *sequencer = (Sequencer){
+        .state = state,
+        .timeline = timeline,
+        .sample_rate = sample_rate,
+        .playing = false,
+        .loop = true,
+        .bar = 0,
+        .row = 0,
+        .cursor = 0,
+        .pos = 0};
+
+    for (int i = 0; i < SEQUENCER_TRACKS; i ++) {
+        sequencer->instruments[i] = -1;
+    }
+
+    return sequencer;
+}
+
+void sequencer_start(Sequencer *sequencer, int bar, double pos) {
+    sequencer->playing = true;
+    sequencer->bar = bar;
+    sequencer->row = 0;
+    sequencer->cursor = 0; // bars have their own slots, starting at 0
+    sequencer->pos = pos;
+
+    for (int i = 0; i < SEQUENCER_TRACKS; i ++) {
+        sequencer->instruments[i] = -1;
+    }
+}
+
+void sequencer_stop(Sequencer *sequencer) {
+    sequencer->playing = false;
+}
+
+inline static double sequencer_row_length(Sequencer *sequencer) {
+    Song *song = sequencer->state->song;
+    return (double)sequencer->sample_rate * 240.0 /
+           ((song->bpm - 1) * (song->step - 1));
+}
+
+double sequencer_bar_pos(Sequencer *sequencer, int bar) {
+    int rows = sequencer->state->song->step - 1;
+    return (double)bar * rows * sequencer_row_length(sequencer);
+}
+
+static void sequencer_schedule_event(Sequencer *sequencer,
+                                     Scheduler *scheduler,
+                                     TimelineEvent const *event,
+                                     uint64_t time) {
+    State *state = sequencer->state;
+    int track = event->track;
+    int note = event->note;
+    int current = sequencer->instruments[track];
+    if (current != -1) {
+        // release goes first, so it doesn't catch the new note
+        NoteEvent release = (NoteEvent){
+            .type = NOTE_EVENT_RELEASE,
+            .time = time,
+            .instrument = current,
+            .track = track,
+            .arpeggio = -1,
+            .note = -1,
+            .song_note = true};
+        scheduler_push(scheduler, &release);
+        sequencer->instruments[track] = -1;
+    }
+
+    if (note == NONE) {
+        return; // note-off
+    }
+
+    // step without instrument plays the last one of the track
+    int instrument = event->instrument != -1 ? event->instrument : current;
+    if (instrument < 0 || instrument >= state->instruments->length) {
+        return;
+    }
+
+    int arpeggio = event->arpeggio;
+    if (arpeggio >= state->arpeggios->length) {
+        arpeggio = -1;
+    }
+
+    NoteEvent trigger = (NoteEvent){
+        .type = NOTE_EVENT_TRIGGER,
+        .time = time,
+        .instrument = instrument,
+        .track = track,
+        .arpeggio = arpeggio,
+        .note = note - 1,
+        .song_note = true};
+    scheduler_push(scheduler, &trigger);
+    sequencer->instruments[track] = instrument;
+}
+
+// gives notes of the track waiting for an instrument the one of
+// an earlier step, -1 drops them
+static void chase_resolve(NoteEvent *notes, bool *waiting, int count,
+                          int track, int instrument) {
+    for (int i = 0; i < count; i ++) {
+        if (waiting[i] && notes[i].track == track) {
+            notes[i].instrument = instrument;
+            waiting[i] = false;
+        }
+    }
+}
+
+int sequencer_chase(Sequencer *sequencer, int bar, uint64_t start,
+                    NoteEvent *notes) {
+    State *state = sequencer->state;
+    int rows = state->song->step - 1;
+    double row_length = sequencer_row_length(sequencer);
+    int start_row = bar * rows;
+    uint64_t tail = (uint64_t)ENVELOPE_MAX_RELEASE * sequencer->sample_rate;
+
+    uint64_t next[SEQUENCER_TRACKS]; // next event of the track, a release
+    bool waits[SEQUENCER_TRACKS]; // notes of the track wait for instrument
+    bool done[SEQUENCER_TRACKS];
+    for (int i = 0; i < SEQUENCER_TRACKS; i ++) {
+        next[i] = UINT64_MAX;
+        waits[i] = false;
+        done[i] = false;
+    }
+
+    TimelineEvent events[TIMELINE_BAR_EVENTS];
+    bool waiting[SEQUENCER_MAX_CHASED];
+    int count = 0;
+    int done_count = 0;
+
+    // bars are scanned backwards until notes released before
+    // the longest release ahead of the start are all that is left
+    for (int i = bar - 1; i >= 0 && done_count < SEQUENCER_TRACKS; i --) {
+        int length = timeline_compile_bar(state, i, events);
+        for (int j = length - 1; j >= 0; j --) {
+            TimelineEvent *event = &events[j];
+            int track = event->track;
+            if (done[track]) {
+                continue;
+            }
+
+            double rows_before = start_row - (i * rows + event->row);
+            uint64_t pos = start - (uint64_t)llround(rows_before * row_length);
+            if (event->note == NONE) {
+                // instrument isn't inherited across note-offs
+                chase_resolve(notes, waiting, count, track, -1);
+                waits[track] = false;
+            } else {
+                if (event->instrument != -1) {
+                    chase_resolve(notes, waiting, count, track,
+                                  event->instrument);
+                    waits[track] = false;
+                }
+
+                bool sounds = next[track] == UINT64_MAX ||
+                              next[track] + tail > start;
+                if (sounds && count < SEQUENCER_MAX_CHASED) {
+                    notes[count] = (NoteEvent){
+                        .type = NOTE_EVENT_CHASE,
+                        .time = pos,
+                        .instrument = event->instrument,
+                        .track = track,
+                        .arpeggio = event->arpeggio,
+                        .note = event->note - 1,
+                        .song_note = true,
+                        .release = next[track]};
+                    waiting[count] = event->instrument == -1;
+                    waits[track] = waits[track] || waiting[count];
+                    count += 1;
+                }
+            }
+
+            next[track] = pos;
+            if (!waits[track] && pos + tail <= start) {
+                done[track] = true;
+                done_count += 1;
+            }
+        }
+    }
+
+    // song starts without an instrument on any track
+    for (int i = 0; i < SEQUENCER_TRACKS; i ++) {
+        if (waits[i]) {
+            chase_resolve(notes, waiting, count, i, -1);
+        }
+    }
+
+    // drop notes which don't sound the same way playback would,
+    // and all but the last note of every instrument of a track
+    int length = 0;
+    for (int i = 0; i < count; i ++) {
+        NoteEvent *note = &notes[i];
+        if (note->instrument < 0 ||
+            note->instrument >= state->instruments->length) {
+            continue;
+        }
+
+        // notes of a track were found from the latest one
+        bool later = false;
+        for (int j = 0; j < length; j ++) {
+            later = later || (notes[j].track == note->track &&
+                              notes[j].instrument == note->instrument);
+        }
+        if (later) {
+            continue;
+        }
+
+        if (note->arpeggio >= state->arpeggios->length) {
+            note->arpeggio = -1;
+        }
+
+        notes[length] = *note;
+        length += 1;
+    }
+
+    return length;
+}
+
+void sequencer_hold(Sequencer *sequencer, NoteEvent const *note) {
+    if (note->release == UINT64_MAX) {
+        sequencer->instruments[note->track] = note->instrument;
+    }
+}
+
+static void sequencer_schedule_row(Sequencer *sequencer,
+                                   Scheduler *scheduler) {
+    uint64_t time = llround(sequencer->pos);
+    int length;
+    TimelineEvent *events = timeline_bar(sequencer->timeline, sequencer->bar,
+                                         &length);
+
+    // bar might have been recompiled since the cursor was set
+    int i = MIN(sequencer->cursor, length);
+    while (i > 0 && events[i - 1].row >= sequencer->row) {
+        i -= 1;
+    }
+    while (i < length && events[i].row < sequencer->row) {
+        i += 1;
+    }
+
+    for (; i < length && events[i].row == sequencer->row; i ++) {
+        sequencer_schedule_event(sequencer, scheduler, &events[i], time);
+    }
+
+    sequencer->cursor = i;
+}
+
+// releases sounding notes at the position of the next row
+static void sequencer_release_all(Sequencer *sequencer,
+                                  Scheduler *scheduler) {
+    for (int i = 0; i < SEQUENCER_TRACKS; i ++) {
+        if (sequencer->instruments[i] == -1) {
+            continue;
+        }
+
+        NoteEvent release = (NoteEvent){
+            .type = NOTE_EVENT_RELEASE,
+            .time = llround(sequencer->pos),
+            .instrument = sequencer->instruments[i],
+            .track = i,
+            .arpeggio = -1,
+            .note = -1,
+            .song_note = true};
+        scheduler_push(scheduler, &release);
+        sequencer->instruments[i] = -1;
+    }
+}
+
+bool sequencer_fill(Sequencer *sequencer, Scheduler *scheduler, uint64_t now) {
+    Song *song = sequencer->state->song;
+    if (!sequencer->playing || song->length <= 0) {
+        return true;
+    }
+
+    int rows = song->step - 1;
+    double until = now + sequencer_row_length(sequencer) * rows *
+                         SEQUENCER_LOOKAHEAD_BARS;
+
+    while (sequencer->pos < until) {
+        // every voice may release and trigger a note on a row
+        if (scheduler->cap - scheduler->length < SEQUENCER_TRACKS * 2) {
+            return false;
+        }
+
+        if (sequencer->bar >= song->length && !sequencer->loop) {
+            sequencer_release_all(sequencer, scheduler);
+            sequencer->playing = false;
+            return true;
+        }
+
+        if (sequencer->bar >= song->length) {
+            sequencer->bar = 0; // song loops
+            sequencer->cursor = 0;
+        }
+
+        sequencer_schedule_row(sequencer, scheduler);
+
+        sequencer->pos += sequencer_row_length(sequencer);
+        sequencer->row += 1;
+        if (sequencer->row >= rows) {
+            sequencer->row = 0;
+            sequencer->bar += 1;
+            sequencer->cursor = 0;
+        }
+    }
+
+    return true;
+}
+
+void sequencer_free(Sequencer *sequencer) {
+    timeline_free(sequencer->timeline);
+    free(sequencer);
+}
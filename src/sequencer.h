@@ -0,0 +1,67 @@
+#ifndef SEQUENCER_H
+#define SEQUENCER_H
+
+#include "state.h" // Song
+#include "scheduler.h" // Scheduler
+#include "timeline.h" // Timeline
+#include "snapshot.h" // ENVELOPE_MAX_RELEASE
+#include "util.h" // MIN
+#include <math.h> // llround
+#include <stdbool.h> // bool
+#include <stdint.h> // uint64_t
+
+#define SEQUENCER_TRACKS (MAX_TRACKS * MAX_PATTERN_VOICES)
+#define SEQUENCER_LOOKAHEAD_BARS 1
+#define SEQUENCER_MAX_CHASED 128 // notes sounding at the playback start
+
+// Walks the compiled song from the start bar row by row and schedules
+// trigger and release events of song notes, never more than
+// SEQUENCER_LOOKAHEAD_BARS ahead of the audio clock.
+// Used only by the audio thread, except for the timeline invalidation
+// and the chase, which reads the song itself
+typedef struct {
+    State *state;
+    Timeline *timeline;
+    int sample_rate;
+    bool playing;
+    bool loop; // otherwise notes are released at the end of the song
+    int bar; // next bar to schedule
+    int row; // next row of the bar to schedule
+    int cursor; // next event of the bar
+    double pos; // sample position of the next row
+    int instruments[SEQUENCER_TRACKS]; // sounding instrument, -1 if none
+} Sequencer;
+
+Sequencer *sequencer_init(State *state, int sample_rate);
+
+// pos doesn't have to fall on a sample, so the rows of a song rendered
+// in parts land on the same samples as if it was rendered at once
+void sequencer_start(Sequencer *sequencer, int bar, double pos);
+
+// sample position of the bar start, as if the song was playing
+// from its beginning at the current tempo
+double sequencer_bar_pos(Sequencer *sequencer, int bar);
+
+void sequencer_stop(Sequencer *sequencer);
+
+// Finds notes which may still sound at start, the first sample of the bar,
+// as if the song had been playing from its beginning at the current
+// tempo: the last note of every instrument of every track, held or
+// released within the longest release. Reads the song rather than
+// the timeline, so it runs on the thread starting the playback.
+// Writes up to SEQUENCER_MAX_CHASED NOTE_EVENT_CHASE events to notes,
+// returns their number
+int sequencer_chase(Sequencer *sequencer, int bar, uint64_t start,
+                    NoteEvent *notes);
+
+// marks a chased note which is still held as sounding on its track,
+// so the next event of the track releases it
+void sequencer_hold(Sequencer *sequencer, NoteEvent const *note);
+
+// schedules rows which start before now + lookahead,
+// returns false if the scheduler ran out of room
+bool sequencer_fill(Sequencer *sequencer, Scheduler *scheduler, uint64_t now);
+
+void sequencer_free(Sequencer *sequencer);
+
+#endif // SEQUENCER_H
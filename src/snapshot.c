@@ -0,0 +1,365 @@
+#include "snapshot.h"
+
+SnapshotTable *snapshot_table_init(State *state, int sample_rate) {
+    RefList *retired = ref_list_init();
+    if (retired == NULL) {
+        return NULL;
+    }
+
+    SnapshotTable *table = malloc(sizeof(SnapshotTable));
+    if (table == NULL) {
+        ref_list_free(retired);
+        return NULL;
+    }
+
+    table->state = state;
+    table->sample_rate = sample_rate;
+    table->retired = retired;
+    atomic_init(&table->epoch, 0);
+    for (int i = 0; i < MAX_INSTRUMENTS; i ++) {
+        atomic_init(&table->instruments[i], NULL);
+    }
+    for (int i = 0; i < MAX_ARPEGGIOS; i ++) {
+        atomic_init(&table->arpeggios[i], NULL);
+    }
+
+    return table;
+}
+
+static StepOp step_op(Operator op, float value) {
+    if (op == OPERATOR_ADD) {
+        return (StepOp){ .relative = true, .value = value };
+    } else if (op == OPERATOR_QADD) {
+        return (StepOp){ .relative = true, .value = value / 4 };
+    } else if (op == OPERATOR_SUB) {
+        return (StepOp){ .relative = true, .value = -value };
+    } else if (op == OPERATOR_QSUB) {
+        return (StepOp){ .relative = true, .value = -value / 4 };
+    }
+    return (StepOp){ .relative = false, .value = value };
+}
+
+// samples of a step of a sequence with step - 1 steps per bar
+static int step_duration(int step, int bpm, int sample_rate) {
+    float duration = (float)sample_rate * 240.0 / ((step - 1) * (bpm - 1));
+    return duration;
+}
+
+WaveFrame wave_frame_apply(WaveSnapshot const *wave, int step_n,
+                           WaveFrame const *prev) {
+    WaveStepSnapshot const *step = &wave->steps[step_n];
+
+    float prev_ring_mod = prev != NULL
+                             ? prev->ring_mod
+                             : INITIAL_RING_MOD - 1;
+    float ring_mod = step_op_apply(step->ring_mod, prev_ring_mod);
+    ring_mod = CLAMP(ring_mod, MIN_RING_MOD - 1, MAX_RING_MOD - 1);
+
+    float prev_ring_mod_amount = prev != NULL
+                             ? prev->ring_mod_amount
+                             : NORM(INITIAL_RING_MOD_AMOUNT,
+                                    MIN_RING_MOD_AMOUNT,
+                                    MAX_RING_MOD_AMOUNT);
+
+    float ring_mod_amount = step_op_apply(step->ring_mod_amount,
+                                          prev_ring_mod_amount);
+
+    ring_mod_amount = NORM(ring_mod_amount, 0, 1);
+
+    float prev_hard_sync = prev != NULL
+                             ? prev->hard_sync
+                             : INITIAL_HARD_SYNC - 1;
+    float hard_sync = step_op_apply(step->hard_sync, prev_hard_sync);
+    hard_sync = CLAMP(hard_sync, MIN_HARD_SYNC - 1, MAX_HARD_SYNC - 1);
+
+    float prev_pulse_width = prev != NULL
+                             ? prev->pulse_width
+                             : NORM(INITIAL_PULSE_WIDTH,
+                                    MIN_PULSE_WIDTH,
+                                    MAX_PULSE_WIDTH);
+
+    float pulse_width = step_op_apply(step->pulse_width, prev_pulse_width);
+
+    // pulse window starts at some offset and it's ends are swapped
+    // when it wraps around the cycle
+    const float o = 0.205026489;
+    float pws = o;
+    float pwe = o + pulse_width;
+    if (pwe > 1.0) {
+        pwe -= 1;
+    }
+    if (pwe < pws) {
+        pwe += pws;
+        pws = pwe - pws;
+        pwe = pwe - pws;
+    }
+
+    return (WaveFrame){
+        .sample_pos = 0,
+        .duration = wave->duration,
+        .step_n = step_n,
+        .form = step->form,
+        .ring_mod = ring_mod,
+        .ring_mod_amount = ring_mod_amount,
+        .hard_sync = hard_sync,
+        .pulse_width = pulse_width,
+        .table = step->table,
+        .pulse_start = CLAMP(pws, 0.0, 1.0),
+        .pulse_end = CLAMP(pwe, 0.0, 1.0)};
+}
+
+FilterFrame filter_frame_apply(FilterSnapshot const *filter, int step_n,
+                               FilterFrame const *prev) {
+    FilterStepSnapshot const *step = &filter->steps[step_n];
+
+    float prev_resonance = prev != NULL
+                             ? prev->resonance
+                             : NORM(INITIAL_RESONANCE,
+                                    MIN_RESONANCE,
+                                    MAX_RESONANCE);
+
+    float resonance = step_op_apply(step->resonance, prev_resonance);
+
+    resonance = NORM(resonance, 0, 1);
+
+    float prev_cutoff = prev != NULL
+                             ? prev->cutoff
+                             : NORM(INITIAL_CUTOFF,
+                                    MIN_CUTOFF,
+                                    MAX_CUTOFF);
+
+    float cutoff = step_op_apply(step->cutoff, prev_cutoff);
+    cutoff = NORM(cutoff, 0, 1);
+
+    return (FilterFrame){
+        .sample_pos = 0,
+        .duration = filter->duration,
+        .step_n = step_n,
+        .resonance = resonance,
+        .cutoff = cutoff};
+}
+
+static void wave_snapshot_compile(WaveSnapshot *snapshot, Wave *wave,
+                                  int bpm, int sample_rate) {
+    snapshot->length = CLAMP(wave->length, 1, MAX_WAVE_STEPS);
+    snapshot->repeat = wave->repeat;
+    snapshot->duration = step_duration(wave->step, bpm, sample_rate);
+
+    for (int i = 0; i < snapshot->length; i ++) {
+        volatile WaveStep *step = &wave->steps[i];
+        char form = step->form;
+        bool saw = (form & WAVE_FORM_SAW) == WAVE_FORM_SAW;
+        bool tri = (form & WAVE_FORM_TRI) == WAVE_FORM_TRI;
+        WaveTableForm table = WAVETABLE_NONE;
+        if (saw && tri) {
+            table = WAVETABLE_SAW_TRI;
+        } else if (saw) {
+            table = WAVETABLE_SAW;
+        } else if (tri) {
+            table = WAVETABLE_TRI;
+        }
+
+        snapshot->steps[i] = (WaveStepSnapshot){
+            .form = form,
+            .table = table,
+            .ring_mod = step_op(step->ring_mod_operator, step->ring_mod - 1),
+            .ring_mod_amount = step_op(step->ring_mod_amount_operator,
+                                       NORM(step->ring_mod_amount,
+                                            MIN_RING_MOD_AMOUNT,
+                                            MAX_RING_MOD_AMOUNT)),
+            .hard_sync = step_op(step->hard_sync_operator,
+                                 step->hard_sync - 1),
+            .pulse_width = step_op(step->pulse_width_operator,
+                                   NORM(step->pulse_width,
+                                        MIN_PULSE_WIDTH,
+                                        MAX_PULSE_WIDTH))};
+    }
+
+    for (int i = 0; i < snapshot->length; i ++) {
+        snapshot->frames[i] = wave_frame_apply(
+            snapshot, i, i > 0 ? &snapshot->frames[i - 1] : NULL);
+    }
+}
+
+static void filter_snapshot_compile(FilterSnapshot *snapshot, Filter *filter,
+                                    int bpm, int sample_rate) {
+    snapshot->length = CLAMP(filter->length, 1, MAX_FILTER_STEPS);
+    snapshot->repeat = filter->repeat;
+    snapshot->duration = step_duration(filter->step, bpm, sample_rate);
+
+    for (int i = 0; i < snapshot->length; i ++) {
+        volatile FilterStep *step = &filter->steps[i];
+        snapshot->steps[i] = (FilterStepSnapshot){
+            .resonance = step_op(step->resonance_operator,
+                                 NORM(step->resonance,
+                                      MIN_RESONANCE,
+                                      MAX_RESONANCE)),
+            .cutoff = step_op(step->cutoff_operator,
+                              NORM(step->cutoff, MIN_CUTOFF, MAX_CUTOFF))};
+    }
+
+    for (int i = 0; i < snapshot->length; i ++) {
+        snapshot->frames[i] = filter_frame_apply(
+            snapshot, i, i > 0 ? &snapshot->frames[i - 1] : NULL);
+    }
+}
+
+static void instrument_snapshot_compile(InstrumentSnapshot *snapshot,
+                                        Instrument *instrument, int bpm,
+                                        int sample_rate) {
+    const float attack = ((float) instrument->attack - 1) / 255 *
+                         (ENVELOPE_MAX_ATTACK - ENVELOPE_MIN_ATTACK) +
+                         ENVELOPE_MIN_ATTACK;
+    const float decay = ((float) instrument->decay - 1) / 255 *
+                        (ENVELOPE_MAX_DECAY - ENVELOPE_MIN_DECAY) +
+                        ENVELOPE_MIN_DECAY;
+
+    const float sustain = ((float) instrument->sustain - 1) / 255;
+
+    const float release = ((float) instrument->release - 1) / 255 *
+                          (ENVELOPE_MAX_RELEASE - ENVELOPE_MIN_RELEASE) +
+                          ENVELOPE_MIN_RELEASE;
+
+    float vol = NORM((float)instrument->volume, MIN_PARAM, MAX_PARAM);
+    float pan = NORM((float)instrument->pan, MIN_PARAM, MAX_PARAM);
+    float pd = fabs(pan - 0.5);
+
+    snapshot->header.retired = 0;
+    snapshot->gain_left = vol * (1 - pan) * (-pd + 1) * 2;
+    snapshot->gain_right = vol * pan * (-pd + 1) * 2;
+    snapshot->attack = attack * sample_rate;
+    snapshot->decay = decay * sample_rate;
+    snapshot->sustain = sustain;
+    snapshot->release = release * sample_rate;
+    wave_snapshot_compile(&snapshot->wave, &instrument->wave, bpm,
+                          sample_rate);
+    filter_snapshot_compile(&snapshot->filter, &instrument->filter, bpm,
+                            sample_rate);
+}
+
+static void arpeggio_snapshot_compile(ArpeggioSnapshot *snapshot,
+                                      Arpeggio *arpeggio, int bpm,
+                                      int sample_rate) {
+    snapshot->header.retired = 0;
+    snapshot->length = CLAMP(arpeggio->length, 1, MAX_ARPEGGIO_STEPS);
+    snapshot->repeat = arpeggio->repeat;
+    snapshot->duration = step_duration(arpeggio->step, bpm, sample_rate);
+
+    // clamp of a clamp is a clamp of the bounds, so every step keeps
+    // the offset from the note and the bounds of all steps before it
+    ArpeggioPoint point = (ArpeggioPoint){
+        .offset = 0,
+        .low = -INFINITY,
+        .high = INFINITY};
+    for (int i = 0; i < snapshot->length; i ++) {
+        volatile ArpeggioStep *step = &arpeggio->steps[i];
+        StepOp op = step_op(step->pitch_operator, step->pitch);
+        if (op.relative) {
+            point.offset += op.value;
+            point.low += op.value;
+            point.high += op.value;
+        } else {
+            point.offset = 0;
+            point.low = op.value;
+            point.high = op.value;
+        }
+        point.low = CLAMP(point.low, 0, MAX_PITCH - 1);
+        point.high = CLAMP(point.high, 0, MAX_PITCH - 1);
+
+        snapshot->steps[i] = op;
+        snapshot->points[i] = point;
+    }
+}
+
+// frees snapshots replaced before the current callback of the audio thread
+static void snapshot_table_collect(SnapshotTable *table) {
+    unsigned int epoch = atomic_load(&table->epoch);
+    for (int i = table->retired->length - 1; i >= 0; i --) {
+        SnapshotHeader *header = ref_list_get(table->retired, i);
+        if ((int)(epoch - header->retired) > 0) {
+            ref_list_del(table->retired, i);
+            free(header);
+        }
+    }
+}
+
+// Snapshot is replaced before the epoch is read, both sequentially
+// consistent as the audio thread's increment and loads are, so any
+// callback with a later epoch can only see the new snapshot
+static bool snapshot_table_retire(SnapshotTable *table,
+                                  SnapshotHeader *old) {
+    snapshot_table_collect(table);
+    if (old == NULL) {
+        return true;
+    }
+
+    old->retired = atomic_load(&table->epoch);
+
+    // if there is no room it is leaked rather than freed under the reader
+    return ref_list_add(table->retired, old);
+}
+
+bool snapshot_table_publish_instrument(SnapshotTable *table, int n) {
+    Instrument *instrument = ref_list_get(table->state->instruments, n);
+    if (instrument == NULL || n >= MAX_INSTRUMENTS) {
+        return false;
+    }
+
+    InstrumentSnapshot *snapshot = malloc(sizeof(InstrumentSnapshot));
+    if (snapshot == NULL) {
+        return false;
+    }
+
+    instrument_snapshot_compile(snapshot, instrument, table->state->song->bpm,
+                                table->sample_rate);
+
+    InstrumentSnapshot *old = atomic_exchange(&table->instruments[n],
+                                              snapshot);
+    return snapshot_table_retire(table, old != NULL ? &old->header : NULL);
+}
+
+bool snapshot_table_publish_arpeggio(SnapshotTable *table, int n) {
+    Arpeggio *arpeggio = ref_list_get(table->state->arpeggios, n);
+    if (arpeggio == NULL || n >= MAX_ARPEGGIOS) {
+        return false;
+    }
+
+    ArpeggioSnapshot *snapshot = malloc(sizeof(ArpeggioSnapshot));
+    if (snapshot == NULL) {
+        return false;
+    }
+
+    arpeggio_snapshot_compile(snapshot, arpeggio, table->state->song->bpm,
+                              table->sample_rate);
+
+    ArpeggioSnapshot *old = atomic_exchange(&table->arpeggios[n], snapshot);
+    return snapshot_table_retire(table, old != NULL ? &old->header : NULL);
+}
+
+bool snapshot_table_publish_all(SnapshotTable *table) {
+    State *state = table->state;
+    bool ok = true;
+    for (int i = 0; i < MIN(state->instruments->length, MAX_INSTRUMENTS);
+         i ++) {
+        ok = snapshot_table_publish_instrument(table, i) && ok;
+    }
+    for (int i = 0; i < MIN(state->arpeggios->length, MAX_ARPEGGIOS);
+         i ++) {
+        ok = snapshot_table_publish_arpeggio(table, i) && ok;
+    }
+    return ok;
+}
+
+void snapshot_table_free(SnapshotTable *table) {
+    for (int i = 0; i < MAX_INSTRUMENTS; i ++) {
+        free(atomic_load(&table->instruments[i]));
+    }
+    for (int i = 0; i < MAX_ARPEGGIOS; i ++) {
+        free(atomic_load(&table->arpeggios[i]));
+    }
+    for (int i = 0; i < table->retired->length; i ++) {
+        free(ref_list_get(table->retired, i));
+    }
+    ref_list_free(table->retired);
+    free(table);
+}
@@ -0,0 +1,192 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "state.h" // Instrument, Arpeggio
+#include "reflist.h" // RefList
+#include "util.h" // NORM
+#include "wavetable.h" // WaveTableForm
+#include <stdatomic.h> // atomic_uint
+#include <math.h> // INFINITY, fabs
+#include <stdbool.h> // bool
+#include <stdint.h> // uint64_t
+#include <stdlib.h> // malloc
+
+#define ENVELOPE_MIN_ATTACK 0.002
+#define ENVELOPE_MAX_ATTACK 8
+#define ENVELOPE_MIN_DECAY 0.006
+#define ENVELOPE_MAX_DECAY 12
+#define ENVELOPE_MIN_RELEASE 0.006
+#define ENVELOPE_MAX_RELEASE 24
+
+// Operand of a step with its operator resolved, so the chain of steps
+// is walked with an add or a copy per parameter
+typedef struct {
+    bool relative; // added to the previous value, otherwise replaces it
+    float value; // normalized the way frames keep the parameter
+} StepOp;
+
+inline static float step_op_apply(StepOp op, float prev) {
+    return op.relative ? prev + op.value : op.value;
+}
+
+// first member of every snapshot
+typedef struct {
+    unsigned int retired; // epoch of the table when it was replaced
+} SnapshotHeader;
+
+// Wave parameters of a note from the step start to the next one
+typedef struct {
+    uint64_t sample_pos;
+    int duration;
+
+    int step_n;
+    char form;
+    float ring_mod; // 1 - 256
+    float ring_mod_amount; // 1 - 256
+    float hard_sync; // 1 - 256
+    float pulse_width; // 1 - 256
+    WaveTableForm table;
+    float pulse_start;
+    float pulse_end;
+} WaveFrame;
+
+typedef struct {
+    uint64_t sample_pos;
+    int duration;
+
+    int step_n;
+    float resonance;
+    float cutoff;
+} FilterFrame;
+
+typedef struct {
+    char form;
+    WaveTableForm table; // saw, tri or both, WAVETABLE_NONE if neither
+    StepOp ring_mod;
+    StepOp ring_mod_amount;
+    StepOp hard_sync;
+    StepOp pulse_width;
+} WaveStepSnapshot;
+
+// Steps start from the initial parameters and apply their operators one
+// after another, so frames of a pass are the same for every note and
+// are expanded up front. Once a sequence without repeat is over, its last
+// step keeps being applied to the frame before
+typedef struct {
+    WaveStepSnapshot steps[MAX_WAVE_STEPS];
+    WaveFrame frames[MAX_WAVE_STEPS]; // of the first pass, at sample 0
+    int length;
+    bool repeat;
+    int duration; // samples of a step
+} WaveSnapshot;
+
+typedef struct {
+    StepOp resonance;
+    StepOp cutoff;
+} FilterStepSnapshot;
+
+typedef struct {
+    FilterStepSnapshot steps[MAX_FILTER_STEPS];
+    FilterFrame frames[MAX_FILTER_STEPS]; // of the first pass, at sample 0
+    int length;
+    bool repeat;
+    int duration; // samples of a step
+} FilterSnapshot;
+
+// Instrument compiled for the sample rate of a context and the song tempo.
+// Never changes once published, edits publish a new one
+typedef struct {
+    SnapshotHeader header;
+    float gain_left;
+    float gain_right;
+    float attack; // envelope stages in samples
+    float decay;
+    float sustain; // level, 0 - 1
+    float release;
+    WaveSnapshot wave;
+    FilterSnapshot filter;
+} InstrumentSnapshot;
+
+// Pitch of an arpeggio step is CLAMP(note + offset, low, high):
+// adding and clamping steps compose into a single add and clamp,
+// so the first pass is shared by notes of any pitch
+typedef struct {
+    float offset;
+    float low;
+    float high;
+} ArpeggioPoint;
+
+typedef struct {
+    SnapshotHeader header;
+    StepOp steps[MAX_ARPEGGIO_STEPS]; // semitones
+    ArpeggioPoint points[MAX_ARPEGGIO_STEPS];
+    int length;
+    bool repeat;
+    int duration; // samples of a step
+} ArpeggioSnapshot;
+
+// Latest snapshots of the instruments and arpeggios of a state.
+// The UI thread compiles and publishes them, the audio thread takes
+// the current ones at the start of its blocks without locking.
+// Replaced snapshots are freed by the UI thread once the audio thread
+// has started a callback after the replacement, as it never keeps
+// snapshots across callbacks
+typedef struct {
+    State *state;
+    int sample_rate;
+    _Atomic(InstrumentSnapshot *) instruments[MAX_INSTRUMENTS];
+    _Atomic(ArpeggioSnapshot *) arpeggios[MAX_ARPEGGIOS];
+    atomic_uint epoch; // callbacks started by the audio thread
+    RefList *retired; // waiting to be freed, UI thread only
+} SnapshotTable;
+
+SnapshotTable *snapshot_table_init(State *state, int sample_rate);
+
+// applies the step to the previous frame, the initial parameters if NULL
+WaveFrame wave_frame_apply(WaveSnapshot const *wave, int step_n,
+                           WaveFrame const *prev);
+
+FilterFrame filter_frame_apply(FilterSnapshot const *filter, int step_n,
+                               FilterFrame const *prev);
+
+inline static float arpeggio_point_pitch(ArpeggioPoint point, float note) {
+    return CLAMP(note + point.offset, point.low, point.high);
+}
+
+// Compiles the instrument n of the state and publishes it in place of
+// the previous one. Tempo is compiled in as well, so its changes have to
+// be published too. UI thread only
+bool snapshot_table_publish_instrument(SnapshotTable *table, int n);
+
+bool snapshot_table_publish_arpeggio(SnapshotTable *table, int n);
+
+// publishes all instruments and arpeggios of the state
+bool snapshot_table_publish_all(SnapshotTable *table);
+
+// called by the audio thread at the start of every callback,
+// before it takes any snapshot
+inline static void snapshot_table_enter(SnapshotTable *table) {
+    atomic_fetch_add(&table->epoch, 1);
+}
+
+// current snapshot, NULL if there is none, valid until the callback ends
+inline static InstrumentSnapshot *snapshot_table_instrument(
+    SnapshotTable *table, int n) {
+    if (n < 0 || n >= MAX_INSTRUMENTS) {
+        return NULL;
+    }
+    return atomic_load(&table->instruments[n]);
+}
+
+inline static ArpeggioSnapshot *snapshot_table_arpeggio(SnapshotTable *table,
+                                                        int n) {
+    if (n < 0 || n >= MAX_ARPEGGIOS) {
+        return NULL;
+    }
+    return atomic_load(&table->arpeggios[n]);
+}
+
+// audio thread has to be stopped
+void snapshot_table_free(SnapshotTable *table);
+
+#endif // SNAPSHOT_H
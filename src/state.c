@@ -184,6 +184,11 @@ Song *song_init(char const *name) {
 
     memcpy(song->name, name, len + 1);
 
+    for (int i = 0; i < MAX_TRACKS; i ++) {
+        song->track_volumes[i] = 256;
+        song->track_pans[i] = 128;
+    }
+
     return song;
 }
 
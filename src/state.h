@@ -169,6 +169,8 @@ typedef struct {
     volatile int bpm;
     volatile int step;
     volatile int patterns[MAX_SONG_LENGTH][MAX_TRACKS];
+    volatile int track_volumes[MAX_TRACKS];
+    volatile int track_pans[MAX_TRACKS];
 } Song;
 
 Song *song_init(char const *name);
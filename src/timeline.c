@@ -0,0 +1,100 @@
+#include "timeline.h"
+
+Timeline *timeline_init(State *state) {
+    TimelineEvent *events = malloc(sizeof(TimelineEvent) * MAX_SONG_LENGTH *
+                                   TIMELINE_BAR_EVENTS);
+    if (events == NULL) {
+        return NULL;
+    }
+
+    Timeline *timeline = malloc(sizeof(Timeline));
+    if (timeline == NULL) {
+        free(events);
+        return NULL;
+    }
+
+    timeline->state = state;
+    timeline->events = events;
+    for (int i = 0; i < MAX_SONG_LENGTH; i ++) {
+        timeline->lengths[i] = 0;
+        atomic_init(&timeline->dirty[i], true);
+    }
+
+    return timeline;
+}
+
+void timeline_invalidate_bar(Timeline *timeline, int bar) {
+    if (bar < 0 || bar >= MAX_SONG_LENGTH) {
+        return;
+    }
+    atomic_store_explicit(&timeline->dirty[bar], true, memory_order_release);
+}
+
+void timeline_invalidate_pattern(Timeline *timeline, int pattern) {
+    Song *song = timeline->state->song;
+    for (int i = 0; i < song->length; i ++) {
+        for (int j = 0; j < MAX_TRACKS; j ++) {
+            if (song->patterns[i][j] == pattern + 1) {
+                timeline_invalidate_bar(timeline, i);
+                break;
+            }
+        }
+    }
+}
+
+void timeline_invalidate(Timeline *timeline) {
+    for (int i = 0; i < MAX_SONG_LENGTH; i ++) {
+        timeline_invalidate_bar(timeline, i);
+    }
+}
+
+int timeline_compile_bar(State *state, int bar, TimelineEvent *events) {
+    Song *song = state->song;
+    int rows = song->step - 1;
+    int length = 0;
+
+    // rows go first, so events come out sorted
+    for (int row = 0; row < rows; row ++) {
+        for (int i = 0; i < MAX_TRACKS; i ++) {
+            Pattern *pattern = ref_list_get(state->patterns,
+                                            song->patterns[bar][i] - 1);
+            if (pattern == NULL || row >= pattern->length - 1) {
+                continue;
+            }
+
+            for (int j = 0; j < MAX_PATTERN_VOICES; j ++) {
+                volatile Step *step = &pattern->steps[row][j];
+                if (step->note == EMPTY) {
+                    continue;
+                }
+
+                events[length] = (TimelineEvent){
+                    .row = row,
+                    .track = i * MAX_PATTERN_VOICES + j,
+                    .instrument = step->instrument - 1,
+                    .arpeggio = step->arpeggio - 1,
+                    .note = step->note};
+                length += 1;
+            }
+        }
+    }
+
+    return length;
+}
+
+TimelineEvent *timeline_bar(Timeline *timeline, int bar, int *length) {
+    TimelineEvent *events = &timeline->events[bar * TIMELINE_BAR_EVENTS];
+    if (atomic_exchange_explicit(&timeline->dirty[bar], false,
+                                 memory_order_acq_rel)) {
+        timeline->lengths[bar] = timeline_compile_bar(timeline->state, bar,
+                                                      events);
+    }
+
+    *length = timeline->lengths[bar];
+    return events;
+}
+
+void timeline_free(Timeline *timeline) {
+    free(timeline->events);
+    free(timeline);
+}
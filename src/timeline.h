@@ -0,0 +1,50 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include "state.h" // Song
+#include <stdatomic.h> // atomic_bool
+#include <stdbool.h> // bool
+#include <stdlib.h> // malloc
+
+// every voice of every track may have an event on every row
+#define TIMELINE_BAR_EVENTS (MAX_PATTERN_STEP * MAX_TRACKS * MAX_PATTERN_VOICES)
+
+// Note or note-off of a pattern step, resolved from the song
+typedef struct {
+    short row; // row of the bar
+    short track;
+    short instrument; // -1 for the last instrument of the track
+    short arpeggio; // -1 for none
+    short note; // NONE for note-off
+} TimelineEvent;
+
+// Song compiled to a flat array of events sorted by row, every bar has its
+// own fixed slot, so a bar is found by its number and recompiled in place.
+// Bars are compiled lazily by the audio thread, edits only mark them dirty
+typedef struct {
+    State *state;
+    TimelineEvent *events; // MAX_SONG_LENGTH slots of TIMELINE_BAR_EVENTS
+    int lengths[MAX_SONG_LENGTH];
+    atomic_bool dirty[MAX_SONG_LENGTH];
+} Timeline;
+
+Timeline *timeline_init(State *state);
+
+// may be called from any thread
+void timeline_invalidate_bar(Timeline *timeline, int bar);
+
+// marks all bars playing the pattern
+void timeline_invalidate_pattern(Timeline *timeline, int pattern);
+
+void timeline_invalidate(Timeline *timeline);
+
+// compiles the bar of the song to up to TIMELINE_BAR_EVENTS events,
+// returns their number; for threads which don't own a timeline
+int timeline_compile_bar(State *state, int bar, TimelineEvent *events);
+
+// returns events of the bar compiling it if it is dirty
+TimelineEvent *timeline_bar(Timeline *timeline, int bar, int *length);
+
+void timeline_free(Timeline *timeline);
+
+#endif // TIMELINE_H
@@ -35,12 +35,27 @@ void pattern_table_auto_set_insrument(Layout *layout, ControlTable *table,
     }
 }
 
+// steps of the selected pattern are edited, bars playing it
+// are compiled again as the playback reaches them
+void pattern_table_invalidate(Interface *interface, Layout *layout) {
+    State *state = layout->state;
+    audio_context_invalidate_pattern(interface->audio,
+                                     state->vars[STATE_VAR_PATTERN] - 1);
+}
+
 void handle_control_note_insert(void *self) {
     Control *control = self;
     Layout *layout = interface_get_layout(control->interface, TAB_PATTERN);
     ControlTable *pattern_table = ref_list_get(layout->tables, 1);
     pattern_table_auto_set_insrument(layout, pattern_table,
                                      control->widget->rect.x, control->widget->rect.y);
+    pattern_table_invalidate(control->interface, layout);
+}
+
+void handle_control_step(void *self) {
+    Control *control = self;
+    Layout *layout = interface_get_layout(control->interface, TAB_PATTERN);
+    pattern_table_invalidate(control->interface, layout);
 }
 
 bool pattern_table_update_pattern(Interface *interface, Layout *layout,
@@ -75,14 +90,16 @@ bool pattern_table_update_pattern(Interface *interface, Layout *layout,
 
         for (int j = 0; j < MAX_PATTERN_VOICES; j++) {
             volatile Step *step = &pattern->steps[i][j];
-            CHECK(control_table_row_add_int(row, &step->instrument, true, NULL,
-                                      interface, 0, MAX_INSTRUMENTS), error);
+            CHECK(control_table_row_add_int(row, &step->instrument, true,
+                                      handle_control_step, interface, 0,
+                                      MAX_INSTRUMENTS), error);
 
             CHECK(control_table_row_add_note(row, &step->note, octave, true,
                                        handle_control_note_insert, interface), error);
 
-            CHECK(control_table_row_add_int(row, &step->arpeggio, true, NULL,
-                                      interface, 0, MAX_ARPEGGIOS), error);
+            CHECK(control_table_row_add_int(row, &step->arpeggio, true,
+                                      handle_control_step, interface, 0,
+                                      MAX_ARPEGGIOS), error);
         }
 
         CHECK(control_table_set(table, i, row), error);
@@ -136,6 +153,7 @@ void handle_control_transpose(void *self) {
     Layout *layout = interface_get_layout(control->interface, TAB_PATTERN);
     ControlTable *pattern_table = ref_list_get(layout->tables, 1);
     pattern_table_transpose(layout, pattern_table);
+    pattern_table_invalidate(control->interface, layout);
 }
 
 ControlTable *init_pattern_params_table(Interface *interface, Layout *layout) {
@@ -219,6 +237,25 @@ void handle_control_pattern_step(void *self) {
     Layout *layout = interface_get_layout(interface, TAB_PATTERN);
     ControlTable *pattern_table = ref_list_get(layout->tables, 1);
     pattern_table_update_pattern(interface, layout, pattern_table);
+
+    // every bar has another number of rows now
+    audio_context_invalidate_bar(interface->audio, -1);
+}
+
+void handle_control_arrangement(void *self) {
+    Control *control = self;
+    Interface *interface = control->interface;
+    Song *song = interface->audio->state->song;
+    int bar = (control->control_int.value - &song->patterns[0][0]) /
+              MAX_TRACKS;
+    audio_context_invalidate_bar(interface->audio, bar);
+}
+
+// step durations are baked into the published snapshots
+void handle_control_bpm(void *self) {
+    Control *control = self;
+    Interface *interface = control->interface;
+    audio_context_update_instrument(interface->audio, -1);
 }
 
 ControlTable *init_song_params_table(Interface *interface, Song *const song) {
@@ -234,7 +271,7 @@ ControlTable *init_song_params_table(Interface *interface, Song *const song) {
         control_table_free(song_params_table);
     }
 
-    if (!control_table_row_add_free_int(row, &song->bpm, false, NULL, interface)) {
+    if (!control_table_row_add_free_int(row, &song->bpm, false, handle_control_bpm, interface)) {
         control_table_row_free(row);
         control_table_free(song_params_table);
         return NULL;
@@ -275,35 +312,35 @@ ControlTable *init_song_arrangement_table(Interface *interface, Song *const song
             return NULL;
         }
 
-        if (!control_table_row_add_int(row, &song->patterns[i][0], true, NULL, interface, MIN_PARAM, MAX_PATTERNS)) {
+        if (!control_table_row_add_int(row, &song->patterns[i][0], true, handle_control_arrangement, interface, MIN_PARAM, MAX_PATTERNS)) {
             goto cleanup;
         }
 
-        if (!control_table_row_add_int(row, &song->patterns[i][1], true, NULL, interface, MIN_PARAM, MAX_PATTERNS)) {
+        if (!control_table_row_add_int(row, &song->patterns[i][1], true, handle_control_arrangement, interface, MIN_PARAM, MAX_PATTERNS)) {
             goto cleanup;
         }
 
-        if (!control_table_row_add_int(row, &song->patterns[i][2], true, NULL, interface, MIN_PARAM, MAX_PATTERNS)) {
+        if (!control_table_row_add_int(row, &song->patterns[i][2], true, handle_control_arrangement, interface, MIN_PARAM, MAX_PATTERNS)) {
             goto cleanup;
         }
 
-        if (!control_table_row_add_int(row, &song->patterns[i][3], true, NULL, interface, MIN_PARAM, MAX_PATTERNS)) {
+        if (!control_table_row_add_int(row, &song->patterns[i][3], true, handle_control_arrangement, interface, MIN_PARAM, MAX_PATTERNS)) {
             goto cleanup;
         }
 
-        if (!control_table_row_add_int(row, &song->patterns[i][4], true, NULL, interface, MIN_PARAM, MAX_PATTERNS)) {
+        if (!control_table_row_add_int(row, &song->patterns[i][4], true, handle_control_arrangement, interface, MIN_PARAM, MAX_PATTERNS)) {
             goto cleanup;
         }
 
-        if (!control_table_row_add_int(row, &song->patterns[i][5], true, NULL, interface, MIN_PARAM, MAX_PATTERNS)) {
+        if (!control_table_row_add_int(row, &song->patterns[i][5], true, handle_control_arrangement, interface, MIN_PARAM, MAX_PATTERNS)) {
             goto cleanup;
         }
 
-        if (!control_table_row_add_int(row, &song->patterns[i][6], true, NULL, interface, MIN_PARAM, MAX_PATTERNS)) {
+        if (!control_table_row_add_int(row, &song->patterns[i][6], true, handle_control_arrangement, interface, MIN_PARAM, MAX_PATTERNS)) {
             goto cleanup;
         }
 
-        if (!control_table_row_add_int(row, &song->patterns[i][7], true, NULL, interface, MIN_PARAM, MAX_PATTERNS)) {
+        if (!control_table_row_add_int(row, &song->patterns[i][7], true, handle_control_arrangement, interface, MIN_PARAM, MAX_PATTERNS)) {
             goto cleanup;
         }
 
@@ -383,7 +420,7 @@ cleanup_song_layout:
     return false;
 }
 
-Interface *interface_init(State *const state) {
+Interface *interface_init(State *const state, AudioContext *audio) {
     RefList *layouts = ref_list_init();
     CHECK_N(layouts, error);
 
@@ -397,7 +434,8 @@ Interface *interface_init(State *const state) {
         .input_repr_length = 0,
         .input_repr_printed_at = -1,
         .focus = NULL,
-        .focus_control = NULL};
+        .focus_control = NULL,
+        .audio = audio};
 
     CHECK(init_layouts(interface, state), error);
 
@@ -5,6 +5,7 @@
 #include "ui_control.h" // Control
 #include "ui_layout.h"  // Layout
 #include "input.h"      // Input
+#include "audio.h"      // AudioContext
 #include <stdlib.h>       // malloc, free
 
 #define MAX_TEXT_WIDTH 24
@@ -37,9 +38,10 @@ typedef struct
     Widget *sub_tab_widget;
     Widget *input_repr_widget;
     Widget *edit_widget;
+    AudioContext *audio; // edits are reported to it for the playback
 } Interface;
 
-Interface *interface_init(State * const state);
+Interface *interface_init(State * const state, AudioContext *audio);
 
 void interface_update(Interface *interface, int draw_time);
 
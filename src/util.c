@@ -9,6 +9,32 @@ int sign(int a) {
     return a > 0 ? 1 : (a < 0 ? -1 : 0);
 }
 
+bool parse_int(char const *text, int min, int max, int *value) {
+    char *end;
+    errno = 0;
+    long parsed = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || errno == ERANGE ||
+        parsed < min || parsed > max) {
+        return false;
+    }
+
+    *value = parsed;
+    return true;
+}
+
+bool parse_float(char const *text, float min, float max, float *value) {
+    char *end;
+    errno = 0;
+    double parsed = strtod(text, &end);
+    if (end == text || *end != '\0' || errno == ERANGE ||
+        !(parsed >= min && parsed <= max)) {
+        return false;
+    }
+
+    *value = parsed;
+    return true;
+}
+
 bool rect_contains(Rect const *rect, Point const *point) {
     return point->x >= rect->x && point->x - rect->x <= rect->width &&
            point->y >= rect->y && point->y - rect->y <= rect->height;
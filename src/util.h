@@ -1,7 +1,9 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <errno.h> // errno
 #include <stdbool.h> // bool
+#include <stdlib.h> // strtol, strtod
 #include <math.h> // sqrt
 
 #define MAX(a, b) (a >= b ? a : b)
@@ -18,6 +20,11 @@
 
 int sign(int a);
 
+// whole text has to be a number from min to max
+bool parse_int(char const *text, int min, int max, int *value);
+
+bool parse_float(char const *text, float min, float max, float *value);
+
 typedef struct {
     int x;
     int y;
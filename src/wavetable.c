@@ -0,0 +1,288 @@
+#include "wavetable.h"
+
+#define WAVETABLE_GEN_SIZE (WAVETABLE_SIZE * WAVETABLE_OVERSAMPLING)
+
+// each table has a guard point at the end for interpolation
+static float wavetables[WAVETABLE_FORMS][WAVETABLE_LEVELS]
+                      [WAVETABLE_SIZE + 1];
+
+static bool wavetables_ready = false;
+
+// naive forms, the same as oscillators used to calculate on every sample
+
+static double naive_saw(double x) {
+    return 1.0 - 2.0 * x;
+}
+
+static double naive_tri(double x) {
+    if (x < 0.25) {
+        return x / 0.25;
+    } else if (x > 0.75) {
+        return -1.0 + (x - 0.75) / 0.25;
+    } else {
+        return 1.0 - 2.0 * (x - 0.25) / 0.5;
+    }
+}
+
+static double naive_and(double a, double b) {
+    const double m = 32767;
+    return (double)((short)round(a * m) & (short)round(b * m)) / m;
+}
+
+static double naive_form(WaveTableForm form, double x) {
+    switch (form) {
+    case WAVETABLE_SAW:
+        return naive_saw(x);
+    case WAVETABLE_TRI:
+        return naive_tri(x);
+    case WAVETABLE_SAW_TRI:
+        return naive_and(naive_saw(x), naive_tri(x));
+    default:
+        return 0;
+    }
+}
+
+// in place radix-2 complex fft, n must be a power of two
+static void fft(double *re, double *im, int n, bool inverse) {
+    for (int i = 1, j = 0; i < n; i ++) {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+
+        if (i < j) {
+            double t = re[i];
+            re[i] = re[j];
+            re[j] = t;
+            t = im[i];
+            im[i] = im[j];
+            im[j] = t;
+        }
+    }
+
+    for (int len = 2; len <= n; len <<= 1) {
+        double a = 2 * PI / len * (inverse ? 1 : -1);
+        double wr = cos(a);
+        double wi = sin(a);
+        for (int i = 0; i < n; i += len) {
+            double cr = 1;
+            double ci = 0;
+            for (int j = 0; j < len / 2; j ++) {
+                int u = i + j;
+                int v = i + j + len / 2;
+                double vr = re[v] * cr - im[v] * ci;
+                double vi = re[v] * ci + im[v] * cr;
+                re[v] = re[u] - vr;
+                im[v] = im[u] - vi;
+                re[u] += vr;
+                im[u] += vi;
+
+                double t = cr * wr - ci * wi;
+                ci = cr * wi + ci * wr;
+                cr = t;
+            }
+        }
+    }
+
+    if (inverse) {
+        for (int i = 0; i < n; i ++) {
+            re[i] /= n;
+            im[i] /= n;
+        }
+    }
+}
+
+// spectrum of the naive form is calculated once, then each level drops
+// harmonics which would alias at the highest pitch of the level's octave
+static void wavetable_generate(WaveTableForm form, double *spec_re,
+                               double *spec_im, double *re, double *im) {
+    const int n = WAVETABLE_GEN_SIZE;
+    for (int i = 0; i < n; i ++) {
+        spec_re[i] = naive_form(form, (double)i / n);
+        spec_im[i] = 0;
+    }
+
+    fft(spec_re, spec_im, n, false);
+
+    for (int level = 0; level < WAVETABLE_LEVELS; level ++) {
+        int harmonics = (WAVETABLE_SIZE / 2) >> level;
+        for (int i = 0; i < n; i ++) {
+            int k = i <= n / 2 ? i : n - i;
+            bool keep = k <= harmonics && k < WAVETABLE_SIZE / 2;
+            re[i] = keep ? spec_re[i] : 0;
+            im[i] = keep ? spec_im[i] : 0;
+        }
+
+        fft(re, im, n, true);
+
+        float *table = wavetables[form][level];
+        for (int i = 0; i < WAVETABLE_SIZE; i ++) {
+            table[i] = re[i * WAVETABLE_OVERSAMPLING];
+        }
+        table[WAVETABLE_SIZE] = table[0];
+    }
+}
+
+bool wavetable_init(void) {
+    if (wavetables_ready) {
+        return true;
+    }
+
+    double *buffer = malloc(sizeof(double) * WAVETABLE_GEN_SIZE * 4);
+    if (buffer == NULL) {
+        return false;
+    }
+
+    double *spec_re = buffer;
+    double *spec_im = buffer + WAVETABLE_GEN_SIZE;
+    double *re = buffer + WAVETABLE_GEN_SIZE * 2;
+    double *im = buffer + WAVETABLE_GEN_SIZE * 3;
+
+    for (int form = 0; form < WAVETABLE_FORMS; form ++) {
+        wavetable_generate(form, spec_re, spec_im, re, im);
+    }
+
+    free(buffer);
+    wavetables_ready = true;
+    return true;
+}
+
+int wavetable_level(float increment) {
+    // level l keeps (size / 2) >> l harmonics,
+    // the highest of them has to stay below half of the sample rate
+    float top = increment * WAVETABLE_SIZE;
+    int level = 0;
+    while (level < WAVETABLE_LEVELS - 1 && top > 1.0) {
+        top /= 2;
+        level += 1;
+    }
+    return level;
+}
+
+float *wavetable_get(WaveTableForm form, int level) {
+    return wavetables[form][CLAMP(level, 0, WAVETABLE_LEVELS - 1)];
+}
+
+static void wavetable_bank_read_scalar(float *phases, float const *increments,
+                                       float const *const *tables,
+                                       float *lanes, int n) {
+    for (int i = 0; i < n; i ++) {
+        float *frame = lanes + i * WAVETABLE_BANK_LANES;
+        for (int l = 0; l < WAVETABLE_BANK_LANES; l ++) {
+            float x = phases[l];
+            frame[l] = wavetable_lookup(tables[l], x);
+
+            x += increments[l];
+            if (x >= 1.0) {
+                x -= (int)x;
+            }
+            phases[l] = x;
+        }
+    }
+}
+
+#ifdef CPU_X86
+// next phases, wrapped with the same truncation as the scalar code
+CPU_TARGET_SSE2
+inline static __m128 wavetable_bank_step(__m128 phase, __m128 increment) {
+    phase = _mm_add_ps(phase, increment);
+    __m128 wraps = _mm_cmpge_ps(phase, _mm_set1_ps(1.0f));
+    __m128 whole = _mm_cvtepi32_ps(_mm_cvttps_epi32(phase));
+    return _mm_sub_ps(phase, _mm_and_ps(wraps, whole));
+}
+
+CPU_TARGET_SSE2
+static void wavetable_bank_read_sse2(float *phases, float const *increments,
+                                     float const *const *tables,
+                                     float *lanes, int n) {
+    // without gathers the samples are loaded one by one, the rest
+    // of the lookup and the phase are done for all lanes at once
+    const __m128 size = _mm_set1_ps(WAVETABLE_SIZE);
+    const __m128i mask = _mm_set1_epi32(WAVETABLE_SIZE - 1);
+    __m128 phase = _mm_loadu_ps(phases);
+    __m128 increment = _mm_loadu_ps(increments);
+    for (int i = 0; i < n; i ++) {
+        __m128 x = _mm_mul_ps(phase, size);
+        __m128i whole = _mm_cvttps_epi32(x);
+        __m128 d = _mm_sub_ps(x, _mm_cvtepi32_ps(whole));
+
+        __m128i ndx = _mm_and_si128(whole, mask);
+        int n0 = _mm_cvtsi128_si32(ndx);
+        int n1 = _mm_cvtsi128_si32(_mm_shuffle_epi32(ndx, 1));
+        int n2 = _mm_cvtsi128_si32(_mm_shuffle_epi32(ndx, 2));
+        int n3 = _mm_cvtsi128_si32(_mm_shuffle_epi32(ndx, 3));
+        __m128 va = _mm_setr_ps(tables[0][n0], tables[1][n1],
+                                tables[2][n2], tables[3][n3]);
+        __m128 vb = _mm_setr_ps(tables[0][n0 + 1], tables[1][n1 + 1],
+                                tables[2][n2 + 1], tables[3][n3 + 1]);
+        _mm_storeu_ps(lanes + i * WAVETABLE_BANK_LANES,
+                      _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), d)));
+        phase = wavetable_bank_step(phase, increment);
+    }
+    _mm_storeu_ps(phases, phase);
+}
+
+CPU_TARGET_AVX2
+static void wavetable_bank_read_avx2(float *phases, float const *increments,
+                                     float const *const *tables,
+                                     float *lanes, int n) {
+    // all tables are in one array, so a lane's table is an offset into it
+    float const *base = &wavetables[0][0][0];
+    int offsets[WAVETABLE_BANK_LANES];
+    for (int l = 0; l < WAVETABLE_BANK_LANES; l ++) {
+        offsets[l] = tables[l] - base;
+    }
+
+    const __m128 size = _mm_set1_ps(WAVETABLE_SIZE);
+    const __m128i mask = _mm_set1_epi32(WAVETABLE_SIZE - 1);
+    const __m128i offset = _mm_loadu_si128((__m128i const *)offsets);
+    __m128 phase = _mm_loadu_ps(phases);
+    __m128 increment = _mm_loadu_ps(increments);
+    for (int i = 0; i < n; i ++) {
+        __m128 x = _mm_mul_ps(phase, size);
+        __m128i whole = _mm_cvttps_epi32(x);
+        __m128 d = _mm_sub_ps(x, _mm_cvtepi32_ps(whole));
+
+        __m128i ndx = _mm_add_epi32(_mm_and_si128(whole, mask), offset);
+        __m128 a = _mm_i32gather_ps(base, ndx, 4);
+        __m128 b = _mm_i32gather_ps(base + 1, ndx, 4);
+        _mm_storeu_ps(lanes + i * WAVETABLE_BANK_LANES,
+                      _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), d)));
+        phase = wavetable_bank_step(phase, increment);
+    }
+    _mm_storeu_ps(phases, phase);
+}
+#endif
+
+static const WavetableBankKernel wavetable_bank_kernels[CPU_KERNELS_COUNT] = {
+    [CPU_KERNELS_SCALAR] = wavetable_bank_read_scalar,
+#ifdef CPU_X86
+    [CPU_KERNELS_SSE2] = wavetable_bank_read_sse2,
+    [CPU_KERNELS_AVX2] = wavetable_bank_read_avx2,
+#endif
+};
+
+static WavetableBankKernel const *wavetable_bank_current =
+    &wavetable_bank_kernels[CPU_KERNELS_BASELINE];
+
+static WavetableBankKernel const *wavetable_bank_entry(CpuKernels kernels) {
+    if (kernels < 0 || kernels >= CPU_KERNELS_COUNT ||
+        wavetable_bank_kernels[kernels] == NULL) {
+        return &wavetable_bank_kernels[CPU_KERNELS_SCALAR];
+    }
+    return &wavetable_bank_kernels[kernels];
+}
+
+WavetableBankKernel wavetable_bank_kernel(CpuKernels kernels) {
+    return *wavetable_bank_entry(kernels);
+}
+
+void wavetable_use_kernels(CpuKernels kernels) {
+    wavetable_bank_current = wavetable_bank_entry(kernels);
+}
+
+void wavetable_bank_read(float *phases, float const *increments,
+                         float const *const *tables, float *lanes, int n) {
+    (*wavetable_bank_current)(phases, increments, tables, lanes, n);
+}
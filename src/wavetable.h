@@ -0,0 +1,68 @@
+#ifndef WAVETABLE_H
+#define WAVETABLE_H
+
+#include "cpu.h" // CpuKernels
+#include "util.h" // PI, MIN, MAX
+#include <math.h> // sin, cos
+#include <stdbool.h> // bool
+#include <stdlib.h> // malloc
+#ifdef CPU_X86
+#include <immintrin.h> // _mm_i32gather_ps
+#endif
+
+#define WAVETABLE_SIZE 2048 // power of 2, lookups wrap with a mask
+#define WAVETABLE_LEVELS 11 // one per octave, from 1024 harmonics to 1
+#define WAVETABLE_OVERSAMPLING 4
+#define WAVETABLE_BANK_LANES 4 // oscillators read side by side
+
+// Band limited tables, normalized to -1 - 1.
+// Pulse is not tabulated, since its width is continuous it is
+// calculated as a difference of two saw tables
+typedef enum {
+    WAVETABLE_NONE = -1,
+    WAVETABLE_SAW = 0,
+    WAVETABLE_TRI,
+    WAVETABLE_SAW_TRI, // saw & tri
+    WAVETABLE_FORMS,
+} WaveTableForm;
+
+// generates tables, safe to call more than once
+bool wavetable_init(void);
+
+// level of the table with all harmonics below nyquist for the oscillator
+// with given phase increment (freq / sample rate)
+int wavetable_level(float increment);
+
+float *wavetable_get(WaveTableForm form, int level);
+
+// x is 0 - 1, phases just below 0 or 1 may round up to exactly 1,
+// which wraps to the start of the table
+inline static float wavetable_lookup(float const *table, float x) {
+    float i = x * WAVETABLE_SIZE;
+    int n = (int)i;
+    float d = i - n;
+    n &= WAVETABLE_SIZE - 1;
+    return table[n] + (table[n + 1] - table[n]) * d;
+}
+
+// Reads n frames of WAVETABLE_BANK_LANES oscillators into interleaved
+// lanes, oscillator l reads tables[l] at phases[l] and steps it by
+// increments[l], wrapping the same way the voice oscillators do.
+// Sample of the lane l in the frame i is lanes[i * WAVETABLE_BANK_LANES + l],
+// tables have to come from wavetable_get
+void wavetable_bank_read(float *phases, float const *increments,
+                         float const *const *tables, float *lanes, int n);
+
+typedef void (*WavetableBankKernel)(float *phases, float const *increments,
+                                    float const *const *tables, float *lanes,
+                                    int n);
+
+// wavetable_bank_read of the set, the scalar one if the set isn't built in
+WavetableBankKernel wavetable_bank_kernel(CpuKernels kernels);
+
+// Makes wavetable_bank_read run the kernel of the set,
+// the CPU_KERNELS_BASELINE one until then.
+// Called before any thread renders audio
+void wavetable_use_kernels(CpuKernels kernels);
+
+#endif // WAVETABLE_H
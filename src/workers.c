@@ -0,0 +1,134 @@
+#define _GNU_SOURCE // pthread_setaffinity_np
+#include "workers.h"
+#include <unistd.h> // sysconf
+
+typedef struct {
+    WorkerPool *pool;
+    int worker;
+} WorkerArg;
+
+static void *worker_loop(void *arg) {
+    WorkerArg *worker_arg = arg;
+    WorkerPool *pool = worker_arg->pool;
+    int worker = worker_arg->worker;
+    free(worker_arg);
+
+    sem_t *start = &pool->start[worker - 1];
+    while (true) {
+        while (sem_wait(start) != 0) {
+            // interrupted by a signal
+        }
+
+        if (atomic_load_explicit(&pool->quit, memory_order_acquire)) {
+            return NULL;
+        }
+
+        pool->task(pool->arg, worker);
+        atomic_fetch_sub_explicit(&pool->pending, 1, memory_order_release);
+    }
+}
+
+// keeps the thread on one CPU, next to the audio thread's caches,
+// the pool still works if the platform doesn't allow it
+static void worker_pin(pthread_t thread, int worker) {
+#ifdef __linux__
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 2) {
+        return;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(worker % cpus, &set);
+    pthread_setaffinity_np(thread, sizeof(set), &set);
+#endif
+}
+
+static void worker_pool_stop(WorkerPool *pool, int started) {
+    atomic_store_explicit(&pool->quit, true, memory_order_release);
+    for (int i = 0; i < started; i ++) {
+        sem_post(&pool->start[i]);
+    }
+    for (int i = 0; i < started; i ++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    for (int i = 0; i < pool->count; i ++) {
+        sem_destroy(&pool->start[i]);
+    }
+}
+
+WorkerPool *worker_pool_init(int count, WorkerTask task, void *arg) {
+    WorkerPool *pool = malloc(sizeof(WorkerPool));
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    pthread_t *threads = malloc(sizeof(pthread_t) * count);
+    if (threads == NULL) {
+        goto cleanup_pool;
+    }
+
+    sem_t *start = malloc(sizeof(sem_t) * count);
+    if (start == NULL) {
+        goto cleanup_threads;
+    }
+
+    *pool = (WorkerPool){
+        .count = count,
+        .threads = threads,
+        .start = start,
+        .task = task,
+        .arg = arg};
+    atomic_init(&pool->pending, 0);
+    atomic_init(&pool->quit, false);
+
+    for (int i = 0; i < count; i ++) {
+        sem_init(&start[i], 0, 0);
+    }
+
+    for (int i = 0; i < count; i ++) {
+        WorkerArg *worker_arg = malloc(sizeof(WorkerArg));
+        if (worker_arg == NULL) {
+            worker_pool_stop(pool, i);
+            goto cleanup_start;
+        }
+
+        *worker_arg = (WorkerArg){ .pool = pool, .worker = i + 1 };
+        if (pthread_create(&threads[i], NULL, worker_loop, worker_arg) != 0) {
+            free(worker_arg);
+            worker_pool_stop(pool, i);
+            goto cleanup_start;
+        }
+        worker_pin(threads[i], i + 1);
+    }
+
+    return pool;
+
+cleanup_start:
+    free(start);
+cleanup_threads:
+    free(threads);
+cleanup_pool:
+    free(pool);
+    return NULL;
+}
+
+void worker_pool_run(WorkerPool *pool) {
+    atomic_store_explicit(&pool->pending, pool->count, memory_order_relaxed);
+    for (int i = 0; i < pool->count; i ++) {
+        sem_post(&pool->start[i]);
+    }
+
+    pool->task(pool->arg, 0);
+
+    // the rest of the work is a fraction of a block, not worth sleeping
+    while (atomic_load_explicit(&pool->pending, memory_order_acquire) > 0) {
+    }
+}
+
+void worker_pool_free(WorkerPool *pool) {
+    worker_pool_stop(pool, pool->count);
+    free(pool->start);
+    free(pool->threads);
+    free(pool);
+}
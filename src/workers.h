@@ -0,0 +1,35 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <pthread.h> // pthread_t
+#include <semaphore.h> // sem_t
+#include <stdatomic.h> // atomic_int
+#include <stdbool.h> // bool
+#include <stdlib.h> // malloc
+
+// worker is 0 for the calling thread, 1..count for the pool threads
+typedef void (*WorkerTask)(void *arg, int worker);
+
+// Small pool of threads pinned to their own CPUs, which run the same task
+// together with the calling thread. The caller only posts semaphores and
+// spins on a counter, so it may be the realtime audio thread
+typedef struct {
+    int count; // threads of the pool, not counting the caller
+    pthread_t *threads;
+    sem_t *start; // one per thread, posted on every run
+    WorkerTask task;
+    void *arg;
+    atomic_int pending; // pool threads still running the task
+    atomic_bool quit;
+} WorkerPool;
+
+// starts count threads, returns NULL if any of them failed to start
+WorkerPool *worker_pool_init(int count, WorkerTask task, void *arg);
+
+// runs the task on all threads of the pool and the calling one,
+// returns once all of them are done
+void worker_pool_run(WorkerPool *pool);
+
+void worker_pool_free(WorkerPool *pool);
+
+#endif // WORKERS_H
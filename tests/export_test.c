@@ -0,0 +1,130 @@
+#include <stdio.h> // printf, fopen
+#include <stdlib.h> // malloc
+#include <string.h> // memcmp
+
+#include "../src/export.h"
+
+#define TEST_BARS 22 // chunks of EXPORT_CHUNK_BARS and a shorter last one
+
+static bool build_song(State *state) {
+    // lead plays short notes, noize pad holds notes across chunk starts
+    if (state_create_instrument(state, "pad") == -1 ||
+        state_create_pattern(state) == -1) {
+        return false;
+    }
+
+    Instrument *pad = ref_list_get(state->instruments, 1);
+    pad->sustain = 200;
+    pad->release = 64; // fades out within the pre-roll
+    pad->pan = 40;
+    instrument_set_wave_step(pad, 0, (WaveStep){
+        .form = WAVE_FORM_NOIZE,
+        .ring_mod_operator = OPERATOR_EQ, .ring_mod = 13,
+        .ring_mod_amount_operator = OPERATOR_EQ, .ring_mod_amount = 1,
+        .hard_sync_operator = OPERATOR_EQ, .hard_sync = 1,
+        .pulse_width_operator = OPERATOR_EQ, .pulse_width = 128});
+
+    // patterns, instruments and arpeggios are numbered from 1
+    Pattern *lead = ref_list_get(state->patterns, 0);
+    Pattern *hold = ref_list_get(state->patterns, 1);
+    for (int i = 0; i < 16; i += 2) {
+        lead->steps[i][0] = (Step){.instrument = 1, .note = 40 + i,
+                                   .arpeggio = 1};
+    }
+    hold->steps[12][0] = (Step){.instrument = 2, .note = 30, .arpeggio = 1};
+
+    for (int i = 0; i < TEST_BARS; i ++) {
+        song_set_pattern(state->song, i, 0, 1);
+        if (i % 3 == 0) {
+            song_set_pattern(state->song, i, 1, 2);
+        }
+    }
+    return true;
+}
+
+static unsigned char *read_file(char const *path, long *size) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    unsigned char *data = NULL;
+    if (fseek(file, 0, SEEK_END) != 0 || (*size = ftell(file)) < 0 ||
+        fseek(file, 0, SEEK_SET) != 0) {
+        goto cleanup;
+    }
+
+    data = malloc(*size);
+    if (data != NULL && fread(data, 1, *size, file) != (size_t)*size) {
+        free(data);
+        data = NULL;
+    }
+
+cleanup:
+    fclose(file);
+    return data;
+}
+
+static bool export_with(State *state, char const *path, int threads) {
+    ExportOptions options = {
+        .path = path,
+        .format = EXPORT_FORMAT_F32,
+        .start_bar = 1,
+        .max_tail = 4,
+        .threads = threads,
+        .preroll = EXPORT_PREROLL_BARS,
+        .sample_rate = 44100};
+    ExportStats stats;
+    if (!export_song(state, &options, &stats)) {
+        printf("export with %d threads failed\n", threads);
+        return false;
+    }
+    return true;
+}
+
+int main(void) {
+    char const *serial_path = "export_test_serial.wav";
+    char const *chunked_path = "export_test_chunked.wav";
+    int failed = 1;
+
+    State *state = state_init((char *)"Export Test");
+    if (state == NULL || !build_song(state)) {
+        printf("song setup failed\n");
+        goto cleanup;
+    }
+
+    if (!export_with(state, serial_path, 1) ||
+        !export_with(state, chunked_path, 4)) {
+        goto cleanup;
+    }
+
+    long serial_size = 0;
+    long chunked_size = 0;
+    unsigned char *serial = read_file(serial_path, &serial_size);
+    unsigned char *chunked = read_file(chunked_path, &chunked_size);
+    if (serial == NULL || chunked == NULL) {
+        printf("reading exports failed\n");
+    } else if (serial_size != chunked_size) {
+        printf("sizes differ: %ld != %ld\n", serial_size, chunked_size);
+    } else if (memcmp(serial, chunked, serial_size) != 0) {
+        long i = 0;
+        while (serial[i] == chunked[i]) {
+            i ++;
+        }
+        printf("samples differ from byte %ld\n", i);
+    } else {
+        printf("chunked export matches single pass, %ld bytes\n",
+               serial_size);
+        failed = 0;
+    }
+    free(serial);
+    free(chunked);
+
+cleanup:
+    remove(serial_path);
+    remove(chunked_path);
+    if (state != NULL) {
+        state_free(state);
+    }
+    return failed;
+}